@@ -0,0 +1,13 @@
+// Per-CPU statistics, from the cpustat() system call.
+// Both the kernel and user programs use this header file.
+// Times are in ticks of the time CSR, which qemu's virt
+// board runs at 10 MHz.
+
+struct cpustat {
+  int cpu;                      // hart id
+  int runq;                     // processes waiting for a CPU; all
+                                // CPUs share one run queue
+  uint64 time;                  // time CSR when the record was taken
+  uint64 idle;                  // time with nothing to run
+  uint64 nswitch;               // switches to a process
+};
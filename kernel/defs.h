@@ -1,16 +1,21 @@
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
+struct iovec;
+struct kcache;
+struct lockclass;
+struct meminfo;
+struct mm;
 struct pipe;
 struct proc;
+struct shm;
+struct spawnact;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
-struct proc_info;
-struct cpu_info;
-struct proc_cpu_num;
 
 // bio.c
 void            binit(void);
@@ -27,6 +32,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -36,12 +42,17 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepread(struct file*, uint64, int n, uint);
+int             filepwrite(struct file*, uint64, int n, uint);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
+int             ireclaimwait(void);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -64,7 +75,12 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            kmeminfo(struct meminfo*);
 void            kfree(void *);
+void            kref(void *);
+int             krefcnt(void *);
 void            kinit(void);
 
 // log.c
@@ -73,7 +89,24 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+uint64          pclookup(struct inode*, uint);
+void            pcupdate(struct inode*, uint, char*, uint);
+void            pcdrop(struct inode*);
+void            shminit(void);
+struct shm*     shmalloc(uint64);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+int             shmrw(struct shm*, int, uint64, uint, int);
+int             vmafault(uint64, int);
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+void            vmafree(struct mm*);
+int             vmaoverlap(struct mm*, uint64, uint64);
+int             vmacopy(struct mm*, struct mm*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -84,16 +117,32 @@ void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+void            profinit(void);
+void            profsample(uint64, uint64, int);
+int             profctl(int);
+void            profexit(struct proc*);
+int             profread(uint64, int);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+int             clone(uint64, uint64, uint64);
+int             spawn(char*, char**, struct spawnact*, int);
+int             vfork(void);
+void            vforkdone(struct proc*);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+struct mm*      mmalloc(struct proc*);
+void            mmput(struct mm*, struct proc*);
+void            mmsync(struct mm*);
+uint64          mmasid(struct mm*);
+void            mmflush(struct mm*, uint64);
 int             kill(int);
 int             killed(struct proc*);
+void            kproc(char*, void (*)(void));
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -104,6 +153,12 @@ void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             wait4(int, uint64, int, uint64);
+int             join(int, uint64);
+void            ruclock(struct proc*, uint64*);
+int             getrusage(int, uint64);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
@@ -112,24 +167,40 @@ void            procdump(void);
 void            pstate(void); // added so that pstate is accesible anywhere def.h header file is included
 void            ps(void); 
 void            set(int pid, int priority);
-int             psinfo(struct proc_info *user_buf, struct cpu_info *cpu_user_buf, struct proc_cpu_num *user_num_buf);
+int             procsnap(uint64, int, int);
+int             cpustat(uint64, int);
+void            kstatstick(void);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// slab.c
+void            kcache_init(struct kcache*, char*, uint);
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+void            kcache_reap(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initlockclass(struct spinlock*, char*, struct lockclass*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+struct lockclass* lockclass(char*, int);
+void            lockacquired(struct lockclass*, int, uint64);
+void            lockreleased(struct lockclass*, uint64);
+int             lockstat(uint64, int, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initsleeplockclass(struct sleeplock*, char*, struct lockclass*);
+void            sleeplockinit(void);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -148,6 +219,9 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+int             fdaction(struct fdtable*, struct spawnact*);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -174,8 +248,13 @@ uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvminval(pagetable_t, uint64, uint64);
+int             uvmprefault(uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int);
+int             uvmsplit(pagetable_t, uint64);
+int             uvmpromote(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -3,7 +3,9 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "mman.h"
 #include "defs.h"
 #include "elf.h"
 
@@ -19,17 +21,32 @@ int flags2perm(int flags)
     return perm;
 }
 
+int flags2prot(int flags)
+{
+    int prot = PROT_READ;
+    if(flags & 0x1)
+      prot |= PROT_EXEC;
+    if(flags & 0x2)
+      prot |= PROT_WRITE;
+    return prot;
+}
+
+// Give p a new address space holding the program path,
+// with the arguments argv on its stack, in place of its
+// old one, if any. Returns argc, or -1 with p unchanged.
+// p is the caller, or a new process from spawn().
 int
-exec(char *path, char **argv)
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct vma *v;
+  struct mm *mm = 0, *oldmm;
+  pagetable_t pagetable;
 
   begin_op();
 
@@ -46,8 +63,11 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // a new address space; any other threads of the
+  // process go on running in the old one.
+  if((mm = mmalloc(p)) == 0)
     goto bad;
+  pagetable = mm->pagetable;
 
   // Load program into memory.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
@@ -61,10 +81,30 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > MMAPBASE)
+      goto bad;
+    if(nseg > 0 && ph.vaddr < sz)
+      goto bad;
+    if(ph.off % PGSIZE == 0 && ph.vaddr >= sz && nseg < NSEG){
+      // map the segment; vmafault() reads pages in from
+      // the page cache as the program touches them.
+      v = &mm->vma[nseg++];
+      v->start = ph.vaddr;
+      v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+      v->prot = flags2prot(ph.flags);
+      v->flags = MAP_PRIVATE | VMA_IMAGE;
+      v->ip = idup(ip);
+      v->off = ph.off;
+      v->filesz = ph.filesz;
+      sz = v->end;
+      continue;
+    }
+    // a segment that cannot be paged from the file
+    // (e.g. a -N binary's), so read it in now.
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
-    sz = sz1;
+    sz = mm->sz = sz1;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
@@ -72,9 +112,6 @@ exec(char *path, char **argv)
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
   // Use the second as the user stack.
@@ -82,7 +119,7 @@ exec(char *path, char **argv)
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
-  sz = sz1;
+  sz = mm->sz = sz1;
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
@@ -109,37 +146,52 @@ exec(char *path, char **argv)
   if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
     goto bad;
 
-  // arguments to user main(argc, argv)
-  // argc is returned via the system call return
-  // value, which goes in a0.
-  p->trapframe->a1 = sp;
-
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
+  // Commit to the user image; p->mm changes under p->lock,
+  // for procsnap().
+  acquire(&p->lock);
+  oldmm = p->mm;
+  p->mm = mm;
   p->pagetable = pagetable;
-  p->sz = sz;
+  release(&p->lock);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  // arguments to user main(argc, argv)
+  // argc is returned via the system call return
+  // value, which goes in a0.
+  p->trapframe->a1 = sp;
+  if(oldmm)
+    mmput(oldmm, p);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(mm)
+    mmput(mm, p);
   return -1;
 }
 
+int
+exec(char *path, char **argv)
+{
+  struct proc *p = myproc();
+  int argc;
+
+  // a vfork()ed child is done with its parent's memory.
+  if((argc = execproc(p, path, argv)) >= 0)
+    vforkdone(p);
+  return argc;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -9,20 +9,23 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +34,10 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kcache_alloc(&ftable.cache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +66,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kcache_free(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -79,6 +75,8 @@ fileclose(struct file *f)
     begin_op();
     iput(ff.ip);
     end_op();
+  } else if(ff.type == FD_SHM){
+    shmput(ff.shm);
   }
 }
 
@@ -101,6 +99,95 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Fault in the user buffers in iov before a read or write
+// copies them with a lock held; see uvmaccess().
+// Returns 0, or -1 if a buffer is not accessible.
+static int
+prefault(struct iovec *iov, int cnt, int write)
+{
+  for(int i = 0; i < cnt; i++)
+    if(uvmprefault((uint64)iov[i].iov_base, iov[i].iov_len, write) < 0)
+      return -1;
+  return 0;
+}
+
+// Read from inode file f at *off into the user buffers in iov,
+// advancing *off. Stops at end of file.
+static int
+inoderead(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r, tot;
+
+  if(prefault(iov, cnt, 1) < 0)
+    return -1;
+  tot = 0;
+  ilock(f->ip);
+  for(i = 0; i < cnt; i++){
+    r = readi(f->ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len);
+    if(r < 0){
+      tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the user buffers in iov to inode file f at *off,
+// advancing *off. Returns the total written, or -1 on error.
+static int
+inodewrite(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // consecutive buffers share a transaction, since
+  // together they are still one contiguous write.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, done = 0, tot = 0;
+  int r, n1, room;
+
+  if(prefault(iov, cnt, 0) < 0)
+    return -1;
+  while(i < cnt){
+    begin_op();
+    ilock(f->ip);
+    for(room = max; i < cnt && room > 0; room -= r){
+      n1 = iov[i].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        done += r;
+        tot += r;
+      }
+      if(r != n1)
+        break;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(f->ip);
+    end_op();
+    if(r != n1){
+      // error from writei. if it ran out of disk blocks
+      // while the reclaim thread had some to free, wait
+      // for them and go on.
+      if(r < 0 || ireclaimwait() == 0)
+        return -1;
+    }
+  }
+  return tot;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -111,6 +198,12 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    // copied out with the pipe's or the device's lock held.
+    if(uvmprefault(addr, n, 1) < 0)
+      return -1;
+  }
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -118,10 +211,11 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    struct iovec iov = { (void*)addr, n };
+    r = inoderead(f, &iov, 1, &f->off);
+  } else if(f->type == FD_SHM){
+    r = shmrw(f->shm, 0, addr, f->off, n);
+    f->off += r;
   } else {
     panic("fileread");
   }
@@ -134,11 +228,16 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(uvmprefault(addr, n, 0) < 0)
+      return -1;
+  }
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -146,33 +245,11 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    struct iovec iov = { (void*)addr, n };
+    ret = inodewrite(f, &iov, 1, &f->off);
+  } else if(f->type == FD_SHM){
+    ret = shmrw(f->shm, 1, addr, f->off, n);
+    f->off += ret;
   } else {
     panic("filewrite");
   }
@@ -180,3 +257,70 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f into cnt buffers.
+// iov is a kernel copy; the buffers are user addresses.
+// A pipe or device returns after the first buffer that
+// receives any data, rather than block to fill the rest.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inoderead(f, iov, cnt, &f->off);
+
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len == 0)
+      continue;
+    r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+    return r;
+  }
+  return 0;
+}
+
+// Write cnt buffers to file f.
+// iov is a kernel copy; the buffers are user addresses.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_INODE)
+    return inodewrite(f, iov, cnt, &f->off);
+
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len) != iov[i].iov_len)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  return tot;
+}
+
+// Read from file f at offset off, without using or
+// changing f's offset. Only for inodes.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  return inoderead(f, &iov, 1, &off);
+}
+
+// Write to file f at offset off, without using or
+// changing f's offset. Only for inodes.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f, &iov, 1, &off);
+}
@@ -1,11 +1,12 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SHM } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
-  uint off;          // FD_INODE
+  struct shm *shm;   // FD_SHM
+  uint off;          // FD_INODE and FD_SHM
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +19,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // itable hash chain; protected by itable.lock
+  struct inode *rnext; // reclaim queue; protected by reclaim.lock
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,9 @@ struct inode {
   short minor;
   short nlink;
   uint size;
+  uint flags;
   uint addrs[NDIRECT+1];
+  uint64 pages;       // page cache: first cached page, or 0
 };
 
 // map major device number to device functions.
@@ -15,10 +15,11 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -37,13 +38,20 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void ireclaim(void);
+static void iorphans(uint dev);
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize != BSIZE)
+    panic("fsinit: unsupported block size");
   initlog(dev, &sb);
+  kproc("reclaim", ireclaim);
+  iorphans(dev);
 }
 
 // Zero a block.
@@ -87,21 +95,40 @@ balloc(uint dev)
   return 0;
 }
 
-// Free a disk block.
+// Finish a run of bfree() calls.
 static void
-bfree(int dev, uint b)
+bfreedone(struct buf *bp)
 {
-  struct buf *bp;
-  int bi, m;
+  if(bp){
+    log_write(bp);
+    brelse(bp);
+  }
+}
 
-  bp = bread(dev, BBLOCK(b, sb));
+// Free a disk block.
+// Frees are batched by bitmap block: *bpp holds the locked
+// bitmap buffer left by the previous call (0 at first), and is
+// only written and released when a block in a different bitmap
+// block is freed. The caller must finish with bfreedone(*bpp).
+// Returns 1 if a new bitmap block was read.
+static int
+bfree(int dev, uint b, struct buf **bpp)
+{
+  struct buf *bp = *bpp;
+  int bi, m, new;
+
+  new = 0;
+  if(bp == 0 || bp->blockno != BBLOCK(b, sb)){
+    bfreedone(bp);
+    bp = *bpp = bread(dev, BBLOCK(b, sb));
+    new = 1;
+  }
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  return new;
 }
 
 // Inodes.
@@ -129,18 +156,17 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to an inode table entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref, and frees the entry when ref falls
+//   to zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +190,41 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table entries come from a slab cache, and are found
+// through a hash table on inum. The itable.lock spin-lock
+// protects the hash table, and since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold itable.lock while using
+// any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kcache cache;
+  struct inode *hash[NIHASH];  // entries in use, chained through ip->next
+  struct lockclass *class;     // of ip->lock; see initlockclass()
 } itable;
 
+// Unlinked inodes waiting for the reclaim thread, which holds
+// their last reference.
+struct {
+  struct spinlock lock;
+  struct inode *head;
+  int pending;                 // inodes queued or being reclaimed
+} reclaim;
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kcache_init(&itable.cache, "inode", sizeof(struct inode));
+  itable.class = lockclass("inode", 1);
+  initlock(&reclaim.lock, "reclaim");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -194,23 +232,31 @@ static struct inode* iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
-// or NULL if there is no free inode.
+// or NULL if there is no free inode, or no memory for one.
 struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
+      // take the in-memory inode first, so that running out
+      // of memory leaves the disk as it was.
+      if((ip = iget(dev, inum)) == 0){
+        brelse(bp);
+        return 0;
+      }
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      dip->flags = I_INLINE;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      return ip;
     }
     brelse(bp);
   }
@@ -235,6 +281,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -243,34 +290,35 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if there is no memory for a new entry.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.hash[inum % NIHASH]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Make a new entry.
+  if((ip = kcache_alloc(&itable.cache)) == 0){
+    release(&itable.lock);
+    return 0;
+  }
+  initsleeplockclass(&ip->lock, "inode", itable.class);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = itable.hash[inum % NIHASH];
+  itable.hash[inum % NIHASH] = ip;
   release(&itable.lock);
 
   return ip;
@@ -308,6 +356,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -326,9 +375,21 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Take ip out of the hash table.
+// Caller holds itable.lock.
+static void
+unhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[ip->inum % NIHASH]; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -347,6 +408,19 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if((ip->flags & I_INLINE) == 0 && ip->addrs[NDIRECT]){
+      // A large file: hand this last reference to the reclaim
+      // thread, which frees the blocks over several transactions.
+      releasesleep(&ip->lock);
+      acquire(&reclaim.lock);
+      ip->rnext = reclaim.head;
+      reclaim.head = ip;
+      reclaim.pending++;
+      wakeup(&reclaim);
+      release(&reclaim.lock);
+      return;
+    }
+
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -357,7 +431,12 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(ip->ref == 1){
+    pcdrop(ip);
+    unhash(ip);
+    kcache_free(&itable.cache, ip);
+  } else
+    ip->ref--;
   release(&itable.lock);
 }
 
@@ -369,12 +448,101 @@ iunlockput(struct inode *ip)
   iput(ip);
 }
 
+static int itruncind(struct inode *ip, int max);
+
+// Body of the reclaim thread. Frees the blocks of large
+// unlinked files queued by iput(), a bounded number of bitmap
+// blocks per transaction, then lets iput() free the inode.
+static void
+ireclaim(void)
+{
+  struct inode *ip;
+  int more;
+
+  for(;;){
+    acquire(&reclaim.lock);
+    while(reclaim.head == 0)
+      sleep(&reclaim, &reclaim.lock);
+    ip = reclaim.head;
+    reclaim.head = ip->rnext;
+    release(&reclaim.lock);
+
+    do {
+      begin_op();
+      ilock(ip);
+      // indirect block + inode block + bitmap blocks.
+      more = itruncind(ip, MAXOPBLOCKS-3);
+      iupdate(ip);
+      iunlock(ip);
+      end_op();
+    } while(more);
+
+    begin_op();
+    iput(ip);
+    end_op();
+
+    acquire(&reclaim.lock);
+    if(--reclaim.pending == 0)
+      wakeup(&reclaim.pending);
+    release(&reclaim.lock);
+  }
+}
+
+// Wait until the reclaim thread has freed the blocks of every
+// file queued for it. Returns 1 if there were any, so that a
+// write that found the disk full knows to try again. Must not
+// be called inside a transaction, since the reclaim thread's
+// transactions could not commit.
+int
+ireclaimwait(void)
+{
+  int waited;
+
+  acquire(&reclaim.lock);
+  waited = reclaim.pending > 0;
+  while(reclaim.pending > 0)
+    sleep(&reclaim.pending, &reclaim.lock);
+  release(&reclaim.lock);
+  return waited;
+}
+
+// Free inodes that a crash left allocated but unlinked:
+// files that were still open, or waiting for the reclaim thread.
+static void
+iorphans(uint dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  struct inode *ip;
+  int inum, orphan;
+
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    orphan = dip->type != 0 && dip->nlink == 0;
+    brelse(bp);
+    if(orphan){
+      begin_op();
+      if((ip = iget(dev, inum)) != 0){
+        ilock(ip);
+        iunlockput(ip);
+      }
+      end_op();
+    }
+  }
+}
+
 // Inode content
 //
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
+//
+// A new inode starts out inline (I_INLINE): its first NINLINE
+// bytes of data live in ip->addrs[] itself, so small files need
+// no data block. writei moves the data out to a block when the
+// file grows past NINLINE; itrunc makes the inode inline again.
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -385,6 +553,9 @@ bmap(struct inode *ip, uint bn)
   uint addr, *a;
   struct buf *bp;
 
+  if(ip->flags & I_INLINE)
+    panic("bmap: inline");
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
       addr = balloc(ip->dev);
@@ -420,35 +591,71 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Free the blocks listed in ip's indirect block, and then the
+// indirect block itself, dirtying at most max+1 bitmap blocks.
+// Returns 1 if the budget ran out first; the indirect block
+// then records which blocks remain.
+// Caller must hold ip->lock and call iupdate().
+static int
+itruncind(struct inode *ip, int max)
+{
+  struct buf *bp, *bmp;
+  uint *a;
+  int j, n;
+
+  if(ip->addrs[NDIRECT] == 0)
+    return 0;
+
+  bmp = 0;
+  n = 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(n >= max && BBLOCK(a[j], sb) != bmp->blockno)
+      break;
+    n += bfree(ip->dev, a[j], &bmp);
+    a[j] = 0;
+  }
+  if(j < NINDIRECT){
+    log_write(bp);
+    brelse(bp);
+    bfreedone(bmp);
+    return 1;
+  }
+  brelse(bp);
+  bfree(ip->dev, ip->addrs[NDIRECT], &bmp);
+  bfreedone(bmp);
+  ip->addrs[NDIRECT] = 0;
+  return 0;
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+  struct buf *bmp;
 
+  if(ip->flags & I_INLINE)
+    memset(ip->addrs, 0, sizeof(ip->addrs));  // data, not block numbers
+
+  pcdrop(ip);
+  itruncind(ip, sb.size);
+
+  bmp = 0;
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfree(ip->dev, ip->addrs[i], &bmp);
       ip->addrs[i] = 0;
     }
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
+  bfreedone(bmp);
 
   ip->size = 0;
+  ip->flags |= I_INLINE;
   iupdate(ip);
 }
 
@@ -472,6 +679,7 @@ int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
+  uint64 pa;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -480,6 +688,24 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    // stores through a MAP_SHARED mapping reach the cached
+    // page before the file, so read the page if there is one.
+    if(ip->pages && (pa = pclookup(ip, PGROUNDDOWN(off))) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      if(either_copyout(user_dst, dst, (char*)pa + off%PGSIZE, m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    if(ip->flags & I_INLINE){
+      m = n - tot;
+      if(either_copyout(user_dst, dst, (char*)ip->addrs + off, m) == -1){
+        tot = -1;
+        break;
+      }
+      continue;
+    }
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -495,6 +721,35 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Move an inline inode's data out to its first data block,
+// so that it can grow past NINLINE bytes.
+// Returns -1, leaving the inode inline, if out of disk space.
+// Caller must hold ip->lock and call iupdate().
+static int
+ispill(struct inode *ip)
+{
+  char data[NINLINE];
+  struct buf *bp;
+  uint addr;
+
+  memmove(data, ip->addrs, NINLINE);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->flags &= ~I_INLINE;
+  if(ip->size == 0)
+    return 0;
+
+  if((addr = bmap(ip, 0)) == 0){
+    memmove(ip->addrs, data, NINLINE);
+    ip->flags |= I_INLINE;
+    return -1;
+  }
+  bp = bread(ip->dev, addr);
+  memmove(bp->data, data, ip->size);
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -513,6 +768,21 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n <= NINLINE){
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return 0;
+      if(ip->pages)
+        pcupdate(ip, off, (char*)ip->addrs + off, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(ispill(ip) < 0)
+      return 0;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -523,6 +793,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    if(ip->pages)
+      pcupdate(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -546,17 +818,277 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
+// Hash a name for the directory index.
+// mkfs/mkfs.c has a copy; the two must agree.
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261U;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+#define DXHEAD(bp)  ((struct dxhead*)((bp)->data + 2*sizeof(struct dirent)))
+#define DXENTRY(bp) ((struct dxentry*)((bp)->data + 3*sizeof(struct dirent)))
+
+// If dp is an indexed directory, return its locked root
+// block; otherwise return 0.
+static struct buf*
+dxroot(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxhead *h;
+  uint addr;
+
+  if(dp->size < 2*BSIZE || (addr = bmap(dp, 0)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  h = DXHEAD(bp);
+  if(h->inum != 0 || h->magic != DXMAGIC || h->nleaf == 0 || h->nleaf > DXMAX){
+    brelse(bp);
+    return 0;
+  }
+  return bp;
+}
+
+// Return the index slot in root block bp whose leaf
+// would hold names with the given hash.
+static struct dxentry*
+dxfind(struct buf *bp, uint hash)
+{
+  struct dxentry *e = DXENTRY(bp);
+  int lo, hi, mid;
+
+  // find the last slot whose hash is <= hash.
+  lo = 0;
+  hi = DXHEAD(bp)->nleaf - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(e[mid].hash <= hash)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &e[lo];
+}
+
+// Read the leaf block named by index slot e.
+static struct buf*
+dxleaf(struct inode *dp, struct dxentry *e)
+{
+  uint addr;
+
+  if(e->block == 0 || e->block >= dp->size / BSIZE || (addr = bmap(dp, e->block)) == 0)
+    panic("dxleaf");
+  return bread(dp->dev, addr);
+}
+
+// Look up name in indexed directory dp, whose locked root
+// block is rbp, and return its inode number, or 0.
+// Releases rbp.
+static uint
+dxlookup(struct inode *dp, struct buf *rbp, char *name, uint *poff)
+{
+  struct dxentry *e;
+  struct dirent *de;
+  struct buf *bp;
+  uint inum;
+
+  // "." and ".." stay in the root block, outside the index.
+  for(de = (struct dirent*)rbp->data; de < (struct dirent*)rbp->data + 2; de++){
+    if(namecmp(name, de->name) == 0){
+      if(poff)
+        *poff = (uchar*)de - rbp->data;
+      inum = de->inum;
+      brelse(rbp);
+      return inum;
+    }
+  }
+
+  e = dxfind(rbp, dirhash(name));
+  bp = dxleaf(dp, e);
+  if(poff)
+    *poff = e->block * BSIZE;
+  brelse(rbp);
+
+  for(de = (struct dirent*)bp->data; de < (struct dirent*)bp->data + DPB; de++){
+    if(de->inum == 0)
+      continue;
+    if(namecmp(name, de->name) == 0){
+      if(poff)
+        *poff += (uchar*)de - bp->data;
+      inum = de->inum;
+      brelse(bp);
+      return inum;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Split the full leaf *bpp, which index slot e in root block
+// rbp points to, moving the upper half of its hashes to a new
+// leaf. On success *bpp is the leaf that should hold hash.
+static int
+dxsplit(struct inode *dp, struct buf *rbp, struct dxentry *e, struct buf **bpp, uint hash)
+{
+  struct dxhead *h = DXHEAD(rbp);
+  struct dxentry *ent = DXENTRY(rbp);
+  struct buf *bp = *bpp, *nbp;
+  struct dirent *de = (struct dirent*)bp->data, *nde, t;
+  uint lbn, addr, split;
+  int i, j, k;
+
+  if(h->nleaf >= DXMAX)
+    return -1;
+
+  // Sort the leaf by hash. A leaf's order is otherwise
+  // arbitrary, so this is safe even if the split fails.
+  for(i = 1; i < DPB; i++){
+    t = de[i];
+    for(j = i; j > 0 && dirhash(de[j-1].name) > dirhash(t.name); j--)
+      de[j] = de[j-1];
+    de[j] = t;
+  }
+
+  // Split near the middle, but never between equal hashes.
+  for(k = DPB/2; k < DPB && dirhash(de[k].name) == dirhash(de[k-1].name); k++)
+    ;
+  if(k == DPB)
+    for(k = DPB/2; k > 0 && dirhash(de[k].name) == dirhash(de[k-1].name); k--)
+      ;
+  if(k == 0)
+    return -1;
+  split = dirhash(de[k].name);
+
+  lbn = dp->size / BSIZE;
+  if((addr = bmap(dp, lbn)) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  nbp = bread(dp->dev, addr);
+  nde = (struct dirent*)nbp->data;
+  for(i = k; i < DPB; i++){
+    nde[i-k] = de[i];
+    memset(&de[i], 0, sizeof(de[i]));
+  }
+  log_write(bp);
+  log_write(nbp);
+
+  // Insert the new leaf into the index just after e.
+  i = e - ent + 1;
+  memmove(&ent[i+1], &ent[i], (h->nleaf - i) * sizeof(*ent));
+  memset(&ent[i], 0, sizeof(ent[i]));
+  ent[i].hash = split;
+  ent[i].block = lbn;
+  h->nleaf++;
+  log_write(rbp);
+
+  if(hash >= split){
+    brelse(bp);
+    *bpp = nbp;
+  } else {
+    brelse(nbp);
+  }
+  return 0;
+}
+
+// Add (name, inum) to indexed directory dp, whose locked
+// root block is rbp. Releases rbp.
+static int
+dxlink(struct inode *dp, struct buf *rbp, char *name, uint inum)
+{
+  uint hash = dirhash(name);
+  struct dirent *de;
+  struct buf *bp;
+
+  bp = dxleaf(dp, dxfind(rbp, hash));
+  for(;;){
+    for(de = (struct dirent*)bp->data; de < (struct dirent*)bp->data + DPB; de++)
+      if(de->inum == 0)
+        break;
+    if(de < (struct dirent*)bp->data + DPB)
+      break;
+    if(dxsplit(dp, rbp, dxfind(rbp, hash), &bp, hash) < 0){
+      brelse(bp);
+      brelse(rbp);
+      return -1;
+    }
+  }
+  brelse(rbp);
+
+  memset(de, 0, sizeof(*de));
+  strncpy(de->name, name, DIRSIZ);
+  de->inum = inum;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Convert dp, a linear directory whose single block is full,
+// into an indexed directory with one leaf. Returns the locked
+// root block, or 0 if dp can't be converted.
+static struct buf*
+dxconvert(struct inode *dp)
+{
+  struct buf *rbp, *lbp;
+  struct dirent *de, *d, *l;
+  struct dxentry *e;
+  uint addr;
+
+  if((addr = bmap(dp, 0)) == 0)
+    return 0;
+  rbp = bread(dp->dev, addr);
+  de = (struct dirent*)rbp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0 ||
+     (addr = bmap(dp, 1)) == 0){
+    brelse(rbp);
+    return 0;
+  }
+
+  lbp = bread(dp->dev, addr);
+  l = (struct dirent*)lbp->data;
+  for(d = de + 2; d < de + DPB; d++)
+    if(d->inum != 0)
+      *l++ = *d;
+  log_write(lbp);
+  brelse(lbp);
+
+  memset(de + 2, 0, BSIZE - 2*sizeof(*de));
+  DXHEAD(rbp)->magic = DXMAGIC;
+  DXHEAD(rbp)->nleaf = 1;
+  e = DXENTRY(rbp);
+  e->hash = 0;
+  e->block = 1;
+  log_write(rbp);
+
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  return rbp;
+}
+
+// Look for a directory entry in a directory, and return
+// its inode number, or 0 if there is none.
 // If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+static uint
+dirfind(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off;
   struct dirent de;
+  struct buf *bp;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((bp = dxroot(dp)) != 0)
+    return dxlookup(dp, bp, name, poff);
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -566,14 +1098,26 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory, and return its
+// inode, or 0 if there is no such entry or no memory for it.
+// If found, set *poff to byte offset of entry.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if((inum = dirfind(dp, name, poff)) == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 int
@@ -581,13 +1125,15 @@ dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
+  struct buf *bp;
 
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  // Check that name is not present. dirfind() rather than
+  // dirlookup(), which could miss it for want of memory.
+  if(dirfind(dp, name, 0) != 0)
     return -1;
-  }
+
+  if((bp = dxroot(dp)) != 0)
+    return dxlink(dp, bp, name, inum);
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -597,6 +1143,11 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // Rather than growing a linear directory past its
+  // first block, switch it to a hashed index.
+  if(off == BSIZE && dp->size == BSIZE && (bp = dxconvert(dp)) != 0)
+    return dxlink(dp, bp, name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -653,9 +1204,10 @@ namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
-  if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
-  else
+  if(*path == '/'){
+    if((ip = iget(ROOTDEV, ROOTINO)) == 0)
+      return 0;
+  } else
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
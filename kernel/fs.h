@@ -3,7 +3,7 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#define BSIZE 4096  // block size; one page, recorded in the super block
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -20,14 +20,21 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes); must equal BSIZE
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
 
+// Bytes of data an inode can hold in addrs[] itself.
+#define NINLINE ((NDIRECT+1) * sizeof(uint))
+
+// dinode flags
+#define I_INLINE 0x1    // data is stored in addrs[], not in blocks
+
 // On-disk inode structure
 struct dinode {
   short type;           // File type
@@ -35,7 +42,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_INLINE
+  uint addrs[NDIRECT+1];   // Data block addresses, or inline data
 };
 
 // Inodes per block.
@@ -58,3 +66,34 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// Hashed (indexed) directories.
+// A directory that outgrows its first block is converted to an
+// index: block 0 keeps "." and "..", followed by a dxhead and a
+// table of dxentry slots sorted by hash.  Slot i names the leaf
+// block holding the entries whose name hash is >= entry[i].hash
+// and < entry[i+1].hash. The other blocks are leaves of plain
+// dirents. Index slots have inum 0, so programs that read a
+// directory as an array of dirents (ls, isdirempty) skip them.
+#define DXMAGIC 0x7864   // "dx"
+
+struct dxhead {
+  ushort inum;      // always 0
+  ushort magic;     // DXMAGIC
+  uint nleaf;       // number of dxentry slots in use
+  uint pad[2];
+};
+
+struct dxentry {
+  ushort inum;      // always 0
+  ushort pad;
+  uint hash;        // lowest hash stored in this leaf
+  uint block;       // leaf's block number within the directory
+  uint pad1;
+};
+
+// Leaves one root index block can describe.
+#define DXMAX         (DPB - 3)
+
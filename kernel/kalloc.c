@@ -1,12 +1,31 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous, aligned blocks of 2^order pages.
+//
+// Free memory is kept by a buddy allocator: a free block of
+// 2^k pages starts at a page number that is a multiple of 2^k,
+// and is on free list k. Allocation splits a larger block if
+// there is no block of the size wanted; freeing a page merges
+// it with its buddy (the other half of the block of twice the
+// size) for as long as the buddy is free too.
+//
+// Each page has a reference count, so that a page can be
+// mapped by several page tables (and held by the page cache).
+// kalloc() returns a page with one reference; kref() adds one;
+// kfree() drops one and frees the page when none are left.
+// A block from kalloc_pages() is 2^order pages with one
+// reference each; kfree_pages() drops them all.
+//
+// When memory runs out, kalloc_pages() asks the slab caches
+// (slab.c) to give back their free pages before it fails.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "meminfo.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
@@ -14,19 +33,36 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+
+// a free block; the lists are circular, with a dummy head.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // free blocks of 2^k pages
+  int nfree[MAXORDER+1];        // length of free[k]
+  uint64 npages;                // pages given to the allocator
+  int ref[NPAGES];
+  char order[NPAGES];           // k if a free block of 2^k pages starts here, else -1
 } kmem;
 
+#define PA2PN(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PN2PA(pn) ((void*)(KERNBASE + (uint64)(pn) * PGSIZE))
+#define PA2REF(pa) (kmem.ref[PA2PN(pa)])
+
 void
 kinit()
 {
+  int k;
+
   initlock(&kmem.lock, "kmem");
+  for(k = 0; k <= MAXORDER; k++)
+    kmem.free[k].next = kmem.free[k].prev = &kmem.free[k];
+  memset(kmem.order, -1, sizeof(kmem.order));
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +71,131 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    PA2REF(p) = 1;
+    kmem.npages++;
     kfree(p);
+  }
+}
+
+// Put the free block of 2^k pages at page number pn on its list.
+// Caller holds kmem.lock.
+static void
+pushblock(uint64 pn, int k)
+{
+  struct run *r = PN2PA(pn);
+
+  r->next = kmem.free[k].next;
+  r->prev = &kmem.free[k];
+  r->next->prev = r;
+  kmem.free[k].next = r;
+  kmem.order[pn] = k;
+  kmem.nfree[k]++;
+}
+
+// Take the free block of 2^k pages at page number pn off its list.
+// Caller holds kmem.lock.
+static void
+popblock(uint64 pn, int k)
+{
+  struct run *r = PN2PA(pn);
+
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.order[pn] = -1;
+  kmem.nfree[k]--;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  uint64 pn, buddy;
+  int k;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(PA2REF(pa) < 1)
+    panic("kfree: ref");
+  if(--PA2REF(pa) > 0){
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
-  r = (struct run*)pa;
+  acquire(&kmem.lock);
+  pn = PA2PN(pa);
+  for(k = 0; k < MAXORDER; k++){
+    buddy = pn ^ (1L << k);
+    if(buddy >= NPAGES || kmem.order[buddy] != k)
+      break;
+    popblock(buddy, k);
+    pn &= ~(1L << k);
+  }
+  pushblock(pn, k);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size, each with one reference.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  uint64 pn, i;
+  int k, reaped = 0;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_pages");
 
+again:
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nfree[k] > 0)
+      break;
+  if(k > MAXORDER){
+    release(&kmem.lock);
+    if(!reaped){
+      // ask the slab caches for their free pages, and look again.
+      reaped = 1;
+      kcache_reap();
+      goto again;
+    }
+    return 0;
+  }
+  pn = PA2PN(kmem.free[k].next);
+  popblock(pn, k);
+  // give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    pushblock(pn + (1L << k), k);
+  }
+  for(i = 0; i < (1L << order); i++)
+    kmem.ref[pn + i] = 1;
   release(&kmem.lock);
+
+  memset(PN2PA(pn), 5, PGSIZE << order); // fill with junk
+  return PN2PA(pn);
+}
+
+// Drop a reference to each page of a block from kalloc_pages().
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 i;
+
+  for(i = 0; i < (1L << order); i++)
+    kfree((char*)pa + i*PGSIZE);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -68,15 +204,47 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  return kalloc_pages(0);
+}
+
+// Add a reference to an allocated page.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  if(PA2REF(pa) < 1)
+    panic("kref: free page");
+  PA2REF(pa)++;
   release(&kmem.lock);
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = PA2REF(pa);
+  release(&kmem.lock);
+  return n;
+}
+
+// Report how much memory is free, and in what sizes of block.
+void
+kmeminfo(struct meminfo *mi)
+{
+  int k;
+
+  acquire(&kmem.lock);
+  mi->npages = kmem.npages;
+  mi->nfree = 0;
+  for(k = 0; k <= MAXORDER; k++){
+    mi->nblocks[k] = kmem.nfree[k];
+    mi->nfree += (uint64)kmem.nfree[k] << k;
+  }
+  release(&kmem.lock);
 }
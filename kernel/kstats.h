@@ -0,0 +1,35 @@
+// The kernel statistics page, mapped read-only into every
+// process at KSTATS, so that programs can read the clock and
+// the kernel's counters without a system call.
+// Both the kernel and user programs use this header file.
+// Times are in ticks of the time CSR, which qemu's virt
+// board runs at 10 MHz.
+//
+// CPU 0 rewrites the page at every clock tick. It makes seq
+// odd before it starts and even again when it is done, so a
+// reader copies the page, and tries again if seq was odd or
+// changed while it copied; see readkstats() in ulib.c.
+
+// MMAPTOP in memlayout.h, just above the mmap() regions.
+#define KSTATS 0x2000000000L
+
+struct kstatcpu {
+  uint64 idle;                  // time scheduler() has had nothing to run
+  uint64 nswitch;               // switches to a process
+  uint64 nsyscall;              // system calls
+  uint64 nintr;                 // device interrupts
+};
+
+struct kstats {
+  uint64 seq;                   // odd while the kernel is rewriting the page
+  uint64 ticks;                 // clock ticks since boot, as uptime() returns
+  uint64 time;                  // time CSR at the last tick
+  uint64 boottime;              // time CSR when the clock started ticking
+  uint64 timefreq;              // ticks of the time CSR per second
+  uint64 nproc;                 // processes, zombies included
+  uint64 nrunnable;             // processes waiting for a CPU
+  uint64 freepages;             // free pages of physical memory
+  int ncpu;                     // CPUs started; cpu[] beyond are zero
+  int pad;
+  struct kstatcpu cpu[NCPU];
+};
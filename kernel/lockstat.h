@@ -0,0 +1,17 @@
+// Lock contention counts, by lock class, from the lockstat()
+// system call. A class is all the locks initialized with the
+// same name. Both the kernel and user programs use this header
+// file.
+
+struct lockstat {
+  char name[16];
+  int sleep;                    // sleep-locks; else spinlocks
+  int pad;
+  uint64 nacquire;              // acquisitions
+  uint64 ncontend;              // acquisitions that had to wait
+  uint64 wait;                  // cycles spinning, or time CSR ticks asleep
+  uint64 maxhold;               // longest held: cycles, or time CSR ticks
+};
+
+// lockstat() flags.
+#define LOCKSTAT_RESET 1        // zero the counts once read
@@ -16,6 +16,7 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    sleeplockinit(); // lock class of sleep-locks' spinlocks
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
@@ -27,7 +28,10 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    shminit();       // shared memory objects
     virtio_disk_init(); // emulated hard disk
+    profinit();      // profiling sample rings
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -0,0 +1,9 @@
+// Physical memory statistics, from the meminfo() system call.
+// Both the kernel and user programs use this header file,
+// after param.h.
+
+struct meminfo {
+  uint64 npages;                // pages of RAM the allocator manages
+  uint64 nfree;                 // of those, pages that are free
+  uint64 nblocks[MAXORDER+1];   // free blocks of 2^k pages, k = 0..MAXORDER
+};
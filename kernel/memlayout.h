@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_FREQ 10000000L         // mtime cycles per second, on qemu's virt board.
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -51,10 +52,6 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
-// map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
-
 // User memory layout.
 // Address zero first:
 //   text
@@ -62,6 +59,16 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   mmap() regions, allocated downward from MMAPTOP
+//   KSTATS (the kernel statistics page, at MMAPTOP; see kstats.h)
+//   ...
+//   TRAPFRAME(i) (thread i's trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+// each thread in a shared page table needs its own trapframe,
+// so each takes a slot that no other thread of the address
+// space is using; see clone().
+#define TRAPFRAME(p) (TRAMPOLINE - ((p)+1)*PGSIZE)
+
+// mmap() regions live in [MMAPBASE, MMAPTOP); sbrk() stops at MMAPBASE.
+#define MMAPTOP (MAXVA / 2)
+#define MMAPBASE (MAXVA / 4)
@@ -0,0 +1,11 @@
+// mmap() protections and flags.
+// Both the kernel and user programs use this header file.
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED  0x1   // stores go to the file
+#define MAP_PRIVATE 0x2   // stores go to a private copy
+
+#define MAP_FAILED  ((void*)-1)
@@ -0,0 +1,670 @@
+//
+// Memory-mapped files: mmap(), munmap(), the page cache
+// that backs them, and the shared memory objects of memfd().
+//
+// An address space's mapped regions are described by mm->vma[],
+// and changed with mm->lock held. Both
+// mmap() and exec() make regions; exec() maps the program's
+// segments as MAP_PRIVATE regions, so that processes running
+// the same program share its text.
+// Nothing is mapped up front; vmafault() fills in a page the
+// first time the process touches it, from usertrap() or from
+// copyin()/copyout(). Pages are unmapped in two steps: the PTEs
+// are made invalid, then, once mmsync() says that no other
+// thread's TLB can still hold them, the pages are freed.
+//
+// The page cache keeps, for each active inode, the pages of
+// the file that are currently mapped somewhere, so that all
+// processes mapping the same page of a file share one physical
+// page. The cache holds one reference to each page (see
+// kalloc.c), and every page table that maps it holds another.
+// writei() keeps cached pages up to date, and readi() reads
+// from them, since a store through a MAP_SHARED mapping reaches
+// the cached page long before the file; itrunc() and the last
+// iput() drop them.
+//
+// MAP_SHARED pages are mapped read-only at first; the first
+// store makes the PTE writable, and a writable PTE tells
+// munmap() and exit() that the page must be written back to
+// the file. MAP_PRIVATE pages are copied on the first store.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "defs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Page cache links, one per physical page. Only meaningful
+// for pages on some inode's ip->pages list.
+struct cpage {
+  uint64 next;   // next cached page of the same inode, or 0
+  uint off;      // offset of the page in the file
+};
+
+static struct cpage cpages[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define CPAGE(pa) (&cpages[((pa) - KERNBASE) / PGSIZE])
+
+// Return the page of ip's data at page-aligned offset off,
+// reading it into the cache if it is not there already.
+// The caller gets a new reference to the page.
+// Returns 0 if off is past the end of the file or
+// if out of memory.
+// Caller must hold ip->lock.
+static uint64
+pcget(struct inode *ip, uint off)
+{
+  uint64 pa;
+
+  for(pa = ip->pages; pa; pa = CPAGE(pa)->next){
+    if(CPAGE(pa)->off == off){
+      kref((void*)pa);
+      return pa;
+    }
+  }
+
+  if(off >= ip->size)
+    return 0;
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  memset((void*)pa, 0, PGSIZE);
+  if(readi(ip, 0, pa, off, PGSIZE) < 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  CPAGE(pa)->off = off;
+  CPAGE(pa)->next = ip->pages;
+  ip->pages = pa;
+  kref((void*)pa);
+  return pa;
+}
+
+// Return ip's cached page at page-aligned offset off, or 0
+// if it is not cached. The caller gets no new reference, so
+// must not use the page once it lets go of ip->lock.
+// Caller must hold ip->lock.
+uint64
+pclookup(struct inode *ip, uint off)
+{
+  uint64 pa;
+
+  for(pa = ip->pages; pa; pa = CPAGE(pa)->next)
+    if(CPAGE(pa)->off == off)
+      return pa;
+  return 0;
+}
+
+// Copy n bytes written to ip at offset off (from kernel
+// address src) into any cached pages they overlap.
+// Called by writei(). Caller must hold ip->lock.
+void
+pcupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  uint64 pa;
+  uint lo, hi;
+
+  for(pa = ip->pages; pa; pa = CPAGE(pa)->next){
+    lo = CPAGE(pa)->off;
+    hi = lo + PGSIZE;
+    if(off + n <= lo || off >= hi)
+      continue;
+    if(off >= lo)
+      memmove((char*)pa + (off - lo), src, min(n, hi - off));
+    else
+      memmove((char*)pa, src + (lo - off), min(off + n - lo, PGSIZE));
+  }
+}
+
+// Drop ip's cached pages. Pages still mapped stay
+// allocated until they are unmapped.
+// Caller must hold ip->lock, or the last reference to ip.
+void
+pcdrop(struct inode *ip)
+{
+  uint64 pa, next;
+
+  for(pa = ip->pages; pa; pa = next){
+    next = CPAGE(pa)->next;
+    kfree((void*)pa);
+  }
+  ip->pages = 0;
+}
+
+// Shared memory objects, made by memfd(). An object is a fixed
+// number of pages, zero-filled when first touched, that every
+// mapping of it shares; like the page cache, the object holds
+// one reference to each page. A struct shm fills one page,
+// with the page list at the end.
+struct shm {
+  struct spinlock lock;
+  int ref;              // open files and mappings
+  uint npages;
+  uint64 pages[];       // physical pages; 0 if not yet touched
+};
+
+#define SHMPAGES ((PGSIZE - sizeof(struct shm)) / sizeof(uint64))
+
+static struct lockclass *shmclass;
+
+void
+shminit(void)
+{
+  shmclass = lockclass("shm", 0);
+}
+
+// Make a shared memory object of size bytes, with one
+// reference. Returns 0 if size is too large or out of memory.
+struct shm*
+shmalloc(uint64 size)
+{
+  struct shm *sh;
+
+  if(size == 0 || PGROUNDUP(size) / PGSIZE > SHMPAGES)
+    return 0;
+  if((sh = (struct shm*)kalloc()) == 0)
+    return 0;
+  memset(sh, 0, PGSIZE);
+  initlockclass(&sh->lock, "shm", shmclass);
+  sh->ref = 1;
+  sh->npages = PGROUNDUP(size) / PGSIZE;
+  return sh;
+}
+
+void
+shmdup(struct shm *sh)
+{
+  acquire(&sh->lock);
+  sh->ref++;
+  release(&sh->lock);
+}
+
+// Drop a reference to sh, freeing it and its pages with
+// the last one. Pages still mapped stay allocated until
+// they are unmapped.
+void
+shmput(struct shm *sh)
+{
+  uint i;
+
+  acquire(&sh->lock);
+  if(--sh->ref > 0){
+    release(&sh->lock);
+    return;
+  }
+  release(&sh->lock);
+
+  for(i = 0; i < sh->npages; i++)
+    if(sh->pages[i])
+      kfree((void*)sh->pages[i]);
+  kfree((void*)sh);
+}
+
+// Return page pn of sh with a new reference, allocating
+// it if this is its first use. Returns 0 if pn is past
+// the end of sh or if out of memory.
+static uint64
+shmpage(struct shm *sh, uint pn)
+{
+  uint64 pa;
+  char *mem;
+
+  if(pn >= sh->npages)
+    return 0;
+  acquire(&sh->lock);
+  if(sh->pages[pn] == 0 && (mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    sh->pages[pn] = (uint64)mem;
+  }
+  if((pa = sh->pages[pn]) != 0)
+    kref((void*)pa);
+  release(&sh->lock);
+  return pa;
+}
+
+// Copy n bytes between user address addr and offset off
+// of sh: into sh if write is set, else out of it.
+// For read() and write() on a memfd.
+// Returns the number of bytes copied.
+int
+shmrw(struct shm *sh, int write, uint64 addr, uint off, int n)
+{
+  uint64 pa, size;
+  int tot, m, r;
+
+  size = (uint64)sh->npages * PGSIZE;
+  if(off >= size)
+    return 0;
+  if(off + n > size)
+    n = size - off;
+  for(tot = 0; tot < n; tot += m, off += m, addr += m){
+    if((pa = shmpage(sh, off / PGSIZE)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    if(write)
+      r = either_copyin((char*)pa + off % PGSIZE, 1, addr, m);
+    else
+      r = either_copyout(1, addr, (char*)pa + off % PGSIZE, m);
+    kfree((void*)pa);
+    if(r == -1)
+      break;
+  }
+  return tot;
+}
+
+// Return mm's region that contains va, or 0.
+static struct vma*
+vmafind(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if((v->ip || v->shm) && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Does any of mm's regions overlap [start, end)?
+int
+vmaoverlap(struct mm *mm, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if((v->ip || v->shm) && v->start < end && start < v->end)
+      return 1;
+  return 0;
+}
+
+// The PTE bit that allows an access (PROT_READ, PROT_WRITE or
+// PROT_EXEC).
+static int
+accessperm(int access)
+{
+  if(access == PROT_WRITE)
+    return PTE_W;
+  if(access == PROT_EXEC)
+    return PTE_X;
+  return PTE_R;
+}
+
+// Find len bytes of unused address space for a new region,
+// as high as possible below MMAPTOP. Returns 0 if none.
+static uint64
+vmagap(struct mm *mm, uint64 len)
+{
+  struct vma *v;
+  uint64 top;
+
+  top = MMAPTOP;
+ again:
+  if(top < MMAPBASE + len)
+    return 0;
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if((v->ip || v->shm) && v->start < top && v->end > top - len){
+      top = v->start;
+      goto again;
+    }
+  }
+  return top - len;
+}
+
+// Return the page of v's file for user address va, with a new
+// reference, or 0.
+static uint64
+vmapage(struct vma *v, uint64 va)
+{
+  struct inode *ip = v->ip;
+  uint64 pa;
+
+  if(v->shm)
+    return shmpage(v->shm, (va - v->start + v->off) / PGSIZE);
+
+  ilock(ip);
+  pa = pcget(ip, va - v->start + v->off);
+  iunlock(ip);
+  return pa;
+}
+
+static int vmamap(struct mm *mm, uint64 va, int access);
+
+// Handle a page fault at user address va in the current
+// process; access is PROT_READ, PROT_WRITE or PROT_EXEC.
+// Returns 0 if the page is now mapped, or -1 if va is
+// not in a region that allows the access.
+int
+vmafault(uint64 va, int access)
+{
+  struct mm *mm = myproc()->mm;
+  int r;
+
+  myproc()->nfault++;
+  acquiresleep(&mm->lock);
+  r = vmamap(mm, PGROUNDDOWN(va), access);
+  releasesleep(&mm->lock);
+  // the TLB may hold the PTE as it was before this fault, or
+  // before another CPU handled one like it (see mmasid()).
+  if(r == 0)
+    mmflush(mm, PGROUNDDOWN(va));
+  return r;
+}
+
+// The body of vmafault(). Caller holds mm->lock.
+static int
+vmamap(struct mm *mm, uint64 va, int access)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 pa, off;
+  char *mem;
+  int perm;
+
+  if((v = vmafind(mm, va)) == 0 || (v->prot & access) == 0){
+    // outside the regions, only a stale TLB entry can fault
+    // on a page the process may use, e.g. just after sbrk().
+    if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V) &&
+       (*pte & PTE_U) && (*pte & accessperm(access)))
+      return 0;
+    return -1;
+  }
+
+  perm = PTE_U;
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // a store to a page that is mapped read-only.
+    if(access != PROT_WRITE){
+      // another thread faulted it in first.
+      return (*pte & PTE_U) ? 0 : -1;
+    }
+    if(*pte & PTE_W)
+      return 0;
+    pa = PTE2PA(*pte);
+    if((v->flags & MAP_PRIVATE) && krefcnt((void*)pa) > 1){
+      // shared with the page cache or another process: copy it.
+      // other threads may still read the old page until mmsync().
+      if((mem = kalloc()) == 0)
+        return -1;
+      memmove(mem, (char*)pa, PGSIZE);
+      *pte = PA2PTE(mem) | perm | PTE_W | PTE_V;
+      mmsync(mm);
+      kfree((void*)pa);
+    } else {
+      // MAP_SHARED: now dirty. MAP_PRIVATE: the last user of a copy.
+      // other CPUs' read-only entries just fault again.
+      *pte |= PTE_W;
+    }
+    return 0;
+  }
+
+  off = va - v->start;
+  if(off + PGSIZE > v->filesz){
+    // some or all of the page lies past the part of the region
+    // backed by the file, as in a program's bss: the process
+    // gets a page of its own, zero past filesz.
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(off < v->filesz){
+      if((pa = vmapage(v, va)) == 0){
+        kfree(mem);
+        return -1;
+      }
+      memmove(mem, (char*)pa, v->filesz - off);
+      kfree((void*)pa);
+    }
+    pa = (uint64)mem;
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_W;
+  } else {
+    if((pa = vmapage(v, va)) == 0)
+      return -1;
+    if(access == PROT_WRITE){
+      if(v->flags & MAP_PRIVATE){
+        if((mem = kalloc()) == 0){
+          kfree((void*)pa);
+          return -1;
+        }
+        memmove(mem, (char*)pa, PGSIZE);
+        kfree((void*)pa);
+        pa = (uint64)mem;
+      }
+      perm |= PTE_W;
+    } else if(v->shm && (v->flags & MAP_SHARED) && (v->prot & PROT_WRITE)){
+      // nothing to write back, so no need to see the first store.
+      perm |= PTE_W;
+    }
+  }
+  if(mappages(mm->pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Write a dirty MAP_SHARED page back to v's file,
+// through the log.
+static void
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->ip;
+  uint off = va - v->start + v->off;
+
+  begin_op();
+  ilock(ip);
+  if(off < ip->size)
+    writei(ip, 0, pa, off, min(PGSIZE, ip->size - off));
+  iunlock(ip);
+  end_op();
+}
+
+// Unmap the pages of mm's region v in [start, end), writing
+// dirty shared pages back to the file once no thread can
+// store to them any more.
+static void
+vmaunmap(struct mm *mm, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+
+  uvminval(mm->pagetable, start, (end - start) / PGSIZE);
+  mmsync(mm);
+  if(v->ip && (v->flags & MAP_SHARED)){
+    for(va = start; va < end; va += PGSIZE){
+      if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_W))
+        vmawriteback(v, va, PTE2PA(*pte));
+    }
+  }
+  uvmunmap(mm->pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Release v's reference to its file, and free the slot.
+static void
+vmaput(struct vma *v)
+{
+  if(v->shm){
+    shmput(v->shm);
+    v->shm = 0;
+    return;
+  }
+  begin_op();
+  iput(v->ip);
+  end_op();
+  v->ip = 0;
+}
+
+// Map len bytes of file f, starting at offset off, into the
+// current process. f is an inode or a memfd.
+// Returns the address, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v, *fv;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((f->type != FD_INODE && f->type != FD_SHM) || f->readable == 0)
+    return -1;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && f->writable == 0)
+    return -1;
+
+  acquiresleep(&mm->lock);
+  fv = 0;
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->ip == 0 && v->shm == 0){
+      fv = v;
+      break;
+    }
+  }
+  len = PGROUNDUP(len);
+  if(fv == 0 || (fv->start = vmagap(mm, len)) == 0){
+    releasesleep(&mm->lock);
+    return -1;
+  }
+  fv->end = fv->start + len;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->off = off;
+  fv->filesz = len;
+  if(f->type == FD_SHM){
+    fv->shm = f->shm;
+    shmdup(fv->shm);
+  } else {
+    fv->ip = idup(f->ip);
+  }
+  releasesleep(&mm->lock);
+  return fv->start;
+}
+
+// Unmap [addr, addr+len) from the current process. The range
+// may cover a whole region, or its beginning or its end,
+// but not a hole in its middle, and not the program's own
+// segments.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  acquiresleep(&mm->lock);
+  if((v = vmafind(mm, addr)) == 0 || end > v->end || (v->flags & VMA_IMAGE) ||
+     (addr != v->start && end != v->end)){
+    releasesleep(&mm->lock);
+    return -1;
+  }
+
+  vmaunmap(mm, v, addr, end);
+  if(addr == v->start){
+    v->off += end - addr;
+    v->filesz -= end - addr;
+    v->start = end;
+  } else {
+    v->end = addr;
+    v->filesz = v->end - v->start;
+  }
+  if(v->start == v->end)
+    vmaput(v);
+  releasesleep(&mm->lock);
+  return 0;
+}
+
+// Unmap all of mm's regions, when its last thread
+// leaves it. The pages of the program's segments are
+// left to be freed with the rest of mm->sz.
+void
+vmafree(struct mm *mm)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->ip || v->shm){
+      if((v->flags & VMA_IMAGE) == 0)
+        vmaunmap(mm, v, v->start, v->end);
+      vmaput(v);
+    }
+  }
+}
+
+// Give a forked child's nmm a copy of mm's regions.
+// Pages already present are shared: MAP_SHARED pages as they
+// are, MAP_PRIVATE pages read-only in both processes, so that
+// the next store to either copies the page. uvmcopy() has
+// already copied the pages of the program's segments.
+// Caller holds mm->lock.
+// Returns 0 on success, -1 on failure.
+int
+vmacopy(struct mm *mm, struct mm *nmm)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  uint64 va, pa;
+
+  for(v = mm->vma, nv = nmm->vma; v < &mm->vma[NVMA]; v++, nv++){
+    if(v->ip == 0 && v->shm == 0)
+      continue;
+    *nv = *v;
+    if(nv->shm)
+      shmdup(nv->shm);
+    else
+      idup(nv->ip);
+    if(v->flags & VMA_IMAGE)
+      continue;
+    for(va = v->start; va < v->end; va += PGSIZE){
+      if((pte = walk(mm->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(v->flags & MAP_PRIVATE)
+        *pte &= ~PTE_W;
+      pa = PTE2PA(*pte);
+      if(mappages(nmm->pagetable, va, PGSIZE, pa, PTE_FLAGS(*pte)) != 0){
+        mmsync(mm);
+        goto bad;
+      }
+      kref((void*)pa);
+    }
+  }
+  // other threads must not go on storing to the pages
+  // that are now shared with the child.
+  mmsync(mm);
+  return 0;
+
+ bad:
+  // nothing was written through nmm's mappings, so there is
+  // nothing to write back, and mm still holds each inode.
+  for(nv = nmm->vma; nv < &nmm->vma[NVMA]; nv++){
+    if(nv->ip == 0 && nv->shm == 0)
+      continue;
+    for(va = nv->start; va < nv->end; va += PGSIZE){
+      if(nv->flags & VMA_IMAGE)
+        break;
+      if((pte = walk(nmm->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+    if(nv->shm)
+      shmput(nv->shm);
+    else
+      iput(nv->ip);
+    nv->ip = 0;
+    nv->shm = 0;
+  }
+  return -1;
+}
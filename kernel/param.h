@@ -1,8 +1,7 @@
-#define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mmap()ed regions per process
+#define NSEG         4   // program segments exec() maps from the file
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,3 +10,7 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER      9  // largest kalloc_pages() block is 2^MAXORDER pages
+#define NPRIO        32  // scheduling priorities; 0, the default, runs first
+#define TICKCYCLES 1000000  // time CSR cycles per clock tick; about 1/10th second in qemu
+#define PROFCYCLES   10000  // time CSR cycles between timer interrupts while profiling
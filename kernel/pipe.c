@@ -3,22 +3,36 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// a pipe's buffer is 2^PIPEORDER contiguous pages, so that a
+// writer can get well ahead of its reader before it must sleep.
+#define PIPEORDER 2
+#define PIPESIZE (PGSIZE << PIPEORDER)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+struct kcache pipecache;
+static struct lockclass *pipeclass;
+
+void
+pipeinit(void)
+{
+  kcache_init(&pipecache, "pipe", sizeof(struct pipe));
+  pipeclass = lockclass("pipe", 0);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +42,15 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kcache_alloc(&pipecache)) == 0)
+    goto bad;
+  if((pi->data = kalloc_pages(PIPEORDER)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  initlockclass(&pi->lock, "pipe", pipeclass);
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,8 +62,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    if(pi->data)
+      kfree_pages(pi->data, PIPEORDER);
+    kcache_free(&pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,7 +87,8 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kfree_pages(pi->data, PIPEORDER);
+    kcache_free(&pipecache, pi);
   } else
     release(&pi->lock);
 }
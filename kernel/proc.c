@@ -3,12 +3,87 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "slab.h"
+#include "wait.h"
+#include "spawn.h"
+#include "rusage.h"
+#include "procsnap.h"
+#include "cpustat.h"
+#include "kstats.h"
+#include "meminfo.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Processes, and the address spaces and open file tables
+// that the threads of one process share, come from slab
+// caches, so there is no fixed limit on their number.
+static struct kcache proccache;
+static struct kcache mmcache;
+static struct kcache fdtcache;
+
+// the classes of their locks, for lockstat(); see initlockclass().
+static struct lockclass *procclass, *mmclass, *fdtclass;
+
+// A kernel stack is a page of the direct map, which is mapped
+// with superpages, so there is no guard page below it to fault
+// when the stack grows too deep. Instead, the bottom word of
+// each stack holds KSTACKMAGIC, and sched() checks that it is
+// still there, so an overflow is caught before long.
+#define KSTACKMAGIC 0x6b737461636b2121L
+
+// The kernel statistics page; see kstats.h and kstatstick().
+static struct kstats *kstats;
+
+// Every process is on the list of all processes, for ps and
+// the like, and in a hash table on its pid, for kill() and
+// set(). ptable.lock protects both; it must be acquired after
+// wait_lock and before any p->lock.
+#define NPIDHASH 256
+
+struct {
+  struct spinlock lock;
+  struct proc *all;                // oldest first, through p->next and p->prev
+  struct proc *last;
+  struct proc *hash[NPIDHASH];     // through p->hnext
+  int n;                           // for kstatstick()
+} ptable;
+
+// Runnable processes: a queue for each priority, in the order
+// they became runnable, and a bitmap of the queues that are not
+// empty, so that the next process is found without a search.
+// runq.lock is acquired after any p->lock.
+struct {
+  struct spinlock lock;
+  struct proc *head[NPRIO];        // through p->rnext and p->rprev
+  struct proc *tail[NPRIO];
+  uint ready;                      // bit i set if head[i] != 0
+  int len;                         // for cpustat() and kstatstick()
+} runq;
+
+// Sleeping processes, hashed on the channel they sleep on,
+// so that wakeup() looks only at those that might match.
+// A process links itself in when it sleeps and unlinks
+// itself when it wakes up, so a queue may also hold
+// processes that have been woken but have not yet run.
+// A queue's lock is acquired before any p->lock.
+#define NSLEEPQ 64
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;               // through p->snext and p->sprev
+} sleepq[NSLEEPQ];
+
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 4) % NSLEEPQ])
+
+// protects mm->ref for every mm. exitgroup() holds it
+// while it takes ptable.lock.
+struct spinlock mm_lock;
+
+// protects futex waits against wakeups; see futexwait().
+struct spinlock futex_lock;
 
 struct proc *initproc;
 
@@ -17,45 +92,52 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static struct proc *pickproc(struct proc *p);
+static void adopt(struct proc *parent, struct proc *p, int thread);
+static void ruswitchin(struct proc *p);
+static void ruswitch(struct proc *p);
+static void ruget(struct proc *p, int children, struct rusage *ru);
+static void ruadd(struct proc *p, struct proc *pp, int thread);
+static void switchdone(void);
+static void mmflushall(struct mm *mm);
+static int killmm(struct proc *p, struct mm *mm);
 
 extern char trampoline[]; // trampoline.S
 
+extern uint64 asidmax;    // vm.c
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
-{
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
-}
-
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&mm_lock, "mm");
+  initlock(&futex_lock, "futex");
+  initlock(&ptable.lock, "ptable");
+  initlock(&runq.lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  kcache_init(&proccache, "proc", sizeof(struct proc));
+  kcache_init(&mmcache, "mm", sizeof(struct mm));
+  kcache_init(&fdtcache, "fdtable", sizeof(struct fdtable));
+  procclass = lockclass("proc", 0);
+  mmclass = lockclass("mm", 1);
+  fdtclass = lockclass("fdtable", 0);
+  if(sizeof(struct kstats) > PGSIZE || KSTATS != MMAPTOP)
+    panic("procinit: kstats");
+  if((kstats = (struct kstats*)kalloc()) == 0)
+    panic("procinit: kstats");
+  memset(kstats, 0, PGSIZE);
+  kstats->boottime = r_time();
+  kstats->timefreq = CLINT_FREQ;
 }
 
 // Must be called with interrupts disabled,
@@ -102,44 +184,62 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Find the process with the given pid, or return 0.
+// Caller must hold ptable.lock.
 static struct proc*
-allocproc(void)
+findproc(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
+  for(p = ptable.hash[pid % NPIDHASH]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
   return 0;
+}
 
-found:
+// Allocate a proc and enter it in the process table.
+// If that works, initialize state required to run in the kernel,
+// and return with p->lock held.
+// If a memory allocation fails, return 0.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
+
+  if((p = kcache_alloc(&proccache)) == 0)
+    return 0;
+  initlockclass(&p->lock, "proc", procclass);
   p->priority = 0;
-  p->pid = allocpid();
   p->state = USED;
+  // the first thread of an address space; see clone().
+  p->tfva = TRAPFRAME(0);
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  // the pid is taken with ptable.lock held, so that
+  // ptable.all stays in pid order for procsnap().
+  acquire(&ptable.lock);
+  p->pid = allocpid();
+  p->next = 0;
+  p->prev = ptable.last;
+  if(ptable.last)
+    ptable.last->next = p;
+  else
+    ptable.all = p;
+  ptable.last = p;
+  ptable.n++;
+  p->hnext = ptable.hash[p->pid % NPIDHASH];
+  ptable.hash[p->pid % NPIDHASH] = p;
+  release(&ptable.lock);
+
+  // Allocate a kernel stack page, and a trapframe page.
+  // The caller gives p an address space to map the
+  // trapframe in.
+  if((p->kstack = (uint64)kalloc()) == 0 ||
+     (p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
+  *(uint64*)p->kstack = KSTACKMAGIC;
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -147,34 +247,45 @@ found:
   p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  acquire(&p->lock);
   return p;
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// and take it out of the process table.
+// its address space and files have already been
+// released, by exit() or by a failed fork() or clone().
+// p must not be running or on the run queue, and
+// p->lock must not be held.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
+  acquire(&ptable.lock);
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.all = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  else
+    ptable.last = p->prev;
+  for(pp = &ptable.hash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  ptable.n--;
+  release(&ptable.lock);
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
-  p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
-  p->parent = 0;
-  p->name[0] = 0;
-  p->chan = 0;
-  p->killed = 0;
-  p->xstate = 0;
-  p->priority = 0;
-  p->state = UNUSED;
+  if(p->kstack)
+    kfree((void*)p->kstack);
+  kcache_free(&proccache, p);
 }
 
 // Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
+// but with trampoline and p's trapframe pages.
 pagetable_t
 proc_pagetable(struct proc *p)
 {
@@ -195,28 +306,240 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe page just below the trampoline page, for
+  // map the trapframe page below the trampoline page, for
   // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  if(mappages(pagetable, p->tfva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
 
+  // map the kernel statistics page, which user code may
+  // read but not write.
+  if(mappages(pagetable, KSTATS, PGSIZE,
+              (uint64)kstats, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, p->tfva, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. The trapframes
+// must already have been unmapped.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, KSTATS, 1, 0);
   uvmfree(pagetable, sz);
 }
 
+// Make a new address space, with no user memory, for p to
+// run in. Returns 0 if out of memory.
+struct mm*
+mmalloc(struct proc *p)
+{
+  struct mm *mm;
+
+  if((mm = kcache_alloc(&mmcache)) == 0)
+    return 0;
+  initsleeplockclass(&mm->lock, "mm", mmclass);
+  mm->ref = 1;
+  if((mm->pagetable = proc_pagetable(p)) == 0){
+    kcache_free(&mmcache, mm);
+    return 0;
+  }
+  return mm;
+}
+
+// Thread p stops using mm: unmap p's trapframe. The last
+// thread to go writes back and unmaps mm's regions and
+// frees its memory.
+void
+mmput(struct mm *mm, struct proc *p)
+{
+  acquiresleep(&mm->lock);
+  uvmunmap(mm->pagetable, p->tfva, 1, 0);
+  // no thread uses p's trapframe now, so there is no need to
+  // wait, but a thread cloned into the slot must not find it
+  // in a TLB.
+  mmflushall(mm);
+  releasesleep(&mm->lock);
+
+  acquire(&mm_lock);
+  if(mm->ref > 1){
+    mm->ref--;
+    release(&mm_lock);
+    // a main thread in exit() may be waiting for p to go.
+    wakeup(&mm->ref);
+    return;
+  }
+  release(&mm_lock);
+
+  // no other thread can reach mm now, so no need for mm->lock.
+  vmafree(mm);
+  proc_freepagetable(mm->pagetable, mm->sz);
+  kcache_free(&mmcache, mm);
+}
+
+// Address space identifiers.
+// A user TLB entry is tagged with the ASID that was in satp when
+// it was made, so entries of different address spaces can live
+// side by side and need not be flushed on every switch between
+// the kernel (ASID 0) and user space, or between processes.
+// Each CPU hands out its own ASIDs, 1 to asidmax, and
+// mm->asid[i] records the one CPU i gave mm, with the CPU's
+// generation above it. When a CPU runs out it starts a new
+// generation and flushes its whole TLB; every mm's ASID from
+// the old generation is then stale, and gets a new one on the
+// CPU's next return to user space.
+#define ASIDBITS 16
+#define ASIDMASK ((1L << ASIDBITS) - 1)
+
+// Return this CPU's ASID for mm, handing out a new one if mm
+// has none from the current generation. Returns 0 if the
+// harts have no ASIDs, in which case trampoline.S flushes
+// the TLB at every switch instead. Interrupts must be off.
+uint64
+mmasid(struct mm *mm)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 a;
+
+  if(asidmax == 0)
+    return 0;
+  a = mm->asid[id];
+  if(c->asidgen != 0 && (a >> ASIDBITS) == c->asidgen)
+    return a & ASIDMASK;
+  if(c->asidgen == 0 || c->asidnext > asidmax){
+    c->asidgen++;
+    c->asidnext = 1;
+    sfence_vma();
+  }
+  a = (c->asidgen << ASIDBITS) | c->asidnext++;
+  mm->asid[id] = a;
+  return a & ASIDMASK;
+}
+
+// Flush this CPU's TLB entry, if any, for user address va in mm.
+void
+mmflush(struct mm *mm, uint64 va)
+{
+  struct cpu *c;
+  uint64 a;
+
+  push_off();
+  c = mycpu();
+  a = mm->asid[cpuid()];
+  if(c->asidgen != 0 && (a >> ASIDBITS) == c->asidgen)
+    sfence_vma_page(va, a & ASIDMASK);
+  pop_off();
+}
+
+// Flush mm's entries from this CPU's TLB, and take away its
+// ASIDs on the others, whose TLBs may hold entries from when
+// they last ran it; they will pick new, empty ones on their
+// next return to user space with mm.
+static void
+mmflushall(struct mm *mm)
+{
+  struct cpu *c;
+  uint64 a;
+  int i, id;
+
+  push_off();
+  c = mycpu();
+  id = cpuid();
+  a = mm->asid[id];
+  if(c->asidgen != 0 && (a >> ASIDBITS) == c->asidgen)
+    sfence_vma_asid(a & ASIDMASK);
+  for(i = 0; i < NCPU; i++){
+    if(i != id)
+      mm->asid[i] = 0;
+  }
+  pop_off();
+}
+
+// Wait until no CPU can still be using a TLB entry for a page
+// of mm that the caller has just unmapped or made read-only.
+// After mmflushall(), a CPU can only be using a stale entry if
+// it is in user space running a thread of mm, with the ASID it
+// had before; so it is enough to wait until each such CPU has
+// trapped into the kernel, which the timer guarantees soon.
+// A CPU on its way out to user space counts itself as there
+// (c->uepoch) before it looks up its ASID, so it either is
+// waited for or sees the ASID gone. There are no
+// inter-processor interrupts to hurry it along.
+// Caller must hold mm->lock.
+void
+mmsync(struct mm *mm)
+{
+  uint64 seen[NCPU];
+  struct cpu *c;
+  struct proc *cp;
+  int i;
+
+  mmflushall(mm);
+  if(mm->ref == 1)
+    return;   // only the caller, and it is in the kernel.
+
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    seen[i] = __atomic_load_n(&cpus[i].uepoch, __ATOMIC_SEQ_CST);
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    // an even epoch means c is in the kernel.
+    while((seen[i] & 1) && __atomic_load_n(&c->uepoch, __ATOMIC_SEQ_CST) == seen[i]){
+      cp = c->proc;
+      if(cp == 0 || cp->mm != mm)
+        break;
+      yield();
+    }
+  }
+}
+
+// Make a table with no open files, with one reference.
+// Returns 0 if out of memory.
+static struct fdtable*
+fdtalloc(void)
+{
+  struct fdtable *fdt;
+
+  if((fdt = kcache_alloc(&fdtcache)) == 0)
+    return 0;
+  initlockclass(&fdt->lock, "fdtable", fdtclass);
+  fdt->ref = 1;
+  return fdt;
+}
+
+// Drop a reference to fdt; the last one closes its files.
+static void
+fdtput(struct fdtable *fdt)
+{
+  acquire(&fdt->lock);
+  if(fdt->ref > 1){
+    fdt->ref--;
+    release(&fdt->lock);
+    return;
+  }
+  release(&fdt->lock);
+
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(fdt->ofile[fd]){
+      struct file *f = fdt->ofile[fd];
+      fileclose(f);
+      fdt->ofile[fd] = 0;
+    }
+  }
+  kcache_free(&fdtcache, fdt);
+}
+
 // a user program that calls exec("/init")
 // assembled from ../user/initcode.S
 // od -t xC ../user/initcode
@@ -238,11 +561,14 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
+  if((p->mm = mmalloc(p)) == 0 || (p->fdt = fdtalloc()) == 0)
+    panic("userinit");
+  p->pagetable = p->mm->pagetable;
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->mm->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -251,29 +577,85 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
 
+// Start of a kernel thread's life; the counterpart of forkret.
+static void
+kprocret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler or sched(),
+  // as in forkret().
+  switchdone();
+  mycpu()->intena = 1;
+  release(&p->lock);
+
+  p->kfn();
+  panic("kproc returned");
+}
+
+// Create a kernel thread that runs fn() in its own process
+// context, so that fn can sleep. It never returns to user space,
+// and has no address space or open files.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  p->kfn = fn;
+  p->context.ra = (uint64)kprocret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size on success, -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz, a;
+  struct mm *mm = myproc()->mm;
+  int promoted = 0;
 
-  sz = p->sz;
+  acquiresleep(&mm->lock);
+  sz = oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > MMAPBASE || (sz = uvmalloc(mm->pagetable, sz, sz + n, PTE_W)) == 0){
+      releasesleep(&mm->lock);
       return -1;
     }
+    // a heap grown a little at a time gets megapages too, as
+    // it fills each aligned 2MB; but not while other threads
+    // could store to the pages being copied.
+    if(mm->ref == 1){
+      for(a = oldsz - oldsz % PXSIZE(1); a + PXSIZE(1) <= sz; a += PXSIZE(1))
+        if(!vmaoverlap(mm, a, a + PXSIZE(1)))
+          promoted |= uvmpromote(mm->pagetable, a);
+      if(promoted)
+        mmsync(mm);
+    }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // a megapage that is only partly unmapped becomes 4KB pages.
+    if(uvmsplit(mm->pagetable, PGROUNDUP(sz + n)) < 0){
+      releasesleep(&mm->lock);
+      return -1;
+    }
+    // other threads may be using the pages until mmsync().
+    if(PGROUNDUP(sz + n) < PGROUNDUP(sz))
+      uvminval(mm->pagetable, PGROUNDUP(sz + n), (PGROUNDUP(sz) - PGROUNDUP(sz + n)) / PGSIZE);
+    mmsync(mm);
+    sz = uvmdealloc(mm->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  releasesleep(&mm->lock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -285,18 +667,31 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
-  // Allocate process.
+  // Allocate process. No one else can find np until
+  // it has a parent, so its lock need not be held while
+  // copying, which may sleep.
   if((np = allocproc()) == 0){
     return -1;
   }
+  release(&np->lock);
+  if((np->mm = mmalloc(np)) == 0)
+    goto bad;
+  np->pagetable = np->mm->pagetable;
+  if((np->fdt = fdtalloc()) == 0)
+    goto bad;
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
+  acquiresleep(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    releasesleep(&p->mm->lock);
+    goto bad;
   }
-  np->sz = p->sz;
+  np->mm->sz = p->mm->sz;
+  if(vmacopy(p->mm, np->mm) < 0){
+    releasesleep(&p->mm->lock);
+    goto bad;
+  }
+  releasesleep(&p->mm->lock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -305,26 +700,284 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->fdt->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if(p->fdt->ofile[i])
+      np->fdt->ofile[i] = filedup(p->fdt->ofile[i]);
+  release(&p->fdt->lock);
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  adopt(p, np, 0);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  if(np->mm)
+    mmput(np->mm, np);
+  if(np->fdt)
+    fdtput(np->fdt);
+  freeproc(np);
+  return -1;
+}
+
+// Find a free trapframe slot in mm's page table for a new
+// thread: the highest one below the trampoline that maps
+// nothing. Caller must hold mm->lock.
+static uint64
+tfslot(struct mm *mm)
+{
+  uint64 va;
+  pte_t *pte;
+
+  for(va = TRAPFRAME(0); ; va -= PGSIZE){
+    pte = walk(mm->pagetable, va, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      return va;
+  }
+}
+
+// Create a new thread in the current process, sharing its
+// address space, open files and current directory. It starts
+// at fn(arg) on the given user stack, with the caller's other
+// registers; it must not return from fn, but call exit().
+// Returns the new thread's id, which is a pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
   release(&np->lock);
 
+  // the new thread's trapframe goes in the shared page table,
+  // in the first slot no other thread is using.
+  acquiresleep(&mm->lock);
+  np->tfva = tfslot(mm);
+  if(mappages(mm->pagetable, np->tfva, PGSIZE,
+              (uint64)(np->trapframe), PTE_R | PTE_W) < 0){
+    releasesleep(&mm->lock);
+    freeproc(np);
+    return -1;
+  }
+  releasesleep(&mm->lock);
+  acquire(&mm_lock);
+  mm->ref++;
+  release(&mm_lock);
+  np->mm = mm;
+  np->pagetable = mm->pagetable;
+
+  acquire(&p->fdt->lock);
+  p->fdt->ref++;
+  release(&p->fdt->lock);
+  np->fdt = p->fdt;
+  np->cwd = idup(p->cwd);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+
   acquire(&wait_lock);
-  np->parent = p;
+  adopt(p, np, 1);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+}
+
+// Create a new process running the program path with arguments
+// argv. Unlike fork() then exec(), nothing of the caller's memory
+// is copied: the child's address space is built straight from
+// the ELF file. The child starts with copies of the caller's open
+// files, changed by the file actions act[0..n-1] (see spawn.h).
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int n)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  release(&np->lock);
+
+  // the child's registers are all zero but for those
+  // execproc() sets.
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+
+  if((np->fdt = fdtalloc()) == 0)
+    goto bad;
+  acquire(&p->fdt->lock);
+  for(i = 0; i < NOFILE; i++)
+    if(p->fdt->ofile[i])
+      np->fdt->ofile[i] = filedup(p->fdt->ofile[i]);
+  release(&p->fdt->lock);
+  for(i = 0; i < n; i++)
+    if(fdaction(np->fdt, &act[i]) < 0)
+      goto bad;
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  adopt(p, np, 0);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
+
+ bad:
+  if(np->mm)
+    mmput(np->mm, np);
+  if(np->fdt)
+    fdtput(np->fdt);
+  freeproc(np);
+  return -1;
+}
+
+// Create a new process that borrows the caller's address space,
+// as a clone()d thread does, instead of copying it, and keep the
+// caller asleep until the child calls exec() or exit(). The
+// child has its own copy of the open files, and returns 0; the
+// caller gets the child's pid, or -1.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  release(&np->lock);
+  if((np->fdt = fdtalloc()) == 0){
+    freeproc(np);
+    return -1;
+  }
+
+  acquiresleep(&mm->lock);
+  np->tfva = tfslot(mm);
+  if(mappages(mm->pagetable, np->tfva, PGSIZE,
+              (uint64)(np->trapframe), PTE_R | PTE_W) < 0){
+    releasesleep(&mm->lock);
+    fdtput(np->fdt);
+    freeproc(np);
+    return -1;
+  }
+  releasesleep(&mm->lock);
+  acquire(&mm_lock);
+  mm->ref++;
+  release(&mm_lock);
+  np->mm = mm;
+  np->pagetable = mm->pagetable;
+
+  acquire(&p->fdt->lock);
+  for(i = 0; i < NOFILE; i++)
+    if(p->fdt->ofile[i])
+      np->fdt->ofile[i] = filedup(p->fdt->ofile[i]);
+  release(&p->fdt->lock);
+  np->cwd = idup(p->cwd);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->a0 = 0;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  adopt(p, np, 0);
+  np->vfork = 1;
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  // the child runs on the caller's user stack, so the caller
+  // must not return to user space until the child is done
+  // with it. only the caller can reap np, so np stays.
+  while(np->vfork)
+    sleep(&np->vfork, &wait_lock);
+  release(&wait_lock);
+
+  return pid;
+}
+
+// p, if vfork() made it, is done with its parent's
+// address space: let the parent go on.
+void
+vforkdone(struct proc *p)
+{
+  // only p clears p->vfork.
+  if(p->vfork == 0)
+    return;
+  acquire(&wait_lock);
+  p->vfork = 0;
+  wakeup(&p->vfork);
+  release(&wait_lock);
+}
+
+// Make p a child of parent, at the head of its child list,
+// to be reaped by join() if thread is set, else by wait().
+// Caller must hold wait_lock. p->ppid and p->thread are set
+// with p->lock held too, so that procsnap() need not take
+// wait_lock.
+static void
+adopt(struct proc *parent, struct proc *p, int thread)
+{
+  acquire(&p->lock);
+  p->ppid = parent->pid;
+  p->thread = thread;
+  release(&p->lock);
+  p->parent = parent;
+  p->sibprev = 0;
+  p->sibnext = parent->child;
+  if(parent->child)
+    parent->child->sibprev = p;
+  parent->child = p;
+}
+
+// Take p off its parent's child list.
+// Caller must hold wait_lock.
+static void
+disown(struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    p->parent->child = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->parent = 0;
 }
 
 // Pass p's abandoned children to init.
@@ -334,33 +987,72 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->child == 0)
+    return;
+  while((pp = p->child) != 0){
+    disown(pp);
+    adopt(initproc, pp, 0);   // so that init's wait() reaps it.
+  }
+  wakeup(initproc);
+}
+
+// The main thread of a process is exiting: kill the other
+// threads in its address space, and wait until they have
+// all left it, so that the process ends as a whole.
+static void
+exitgroup(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  int n;
+
+  acquire(&mm_lock);
+  for(;;){
+    // killed again each time round, in case one was
+    // clone()ing another.
+    acquire(&ptable.lock);
+    n = killmm(p, mm);
+    release(&ptable.lock);
+    if(n == 0)
+      break;
+    sleep(&mm->ref, &mm_lock);
   }
+  release(&mm_lock);
 }
 
-// Exit the current process.  Does not return.
+// Exit the current thread. If it was not made by clone(),
+// it is the main thread, and the whole process exits: the
+// other threads are killed, and are gone by the time the
+// parent's wait() sees p exit. Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait() (join() for a thread).
 void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct mm *mm;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // a vfork() child only borrows its parent's address space.
+  if(p->thread == 0 && p->vfork == 0 && p->mm)
+    exitgroup(p);
+  profexit(p);
+
+  // Leave the address space; the last thread to leave
+  // writes back and unmaps mmap()ed regions and frees it.
+  // p->mm changes under p->lock, for procsnap().
+  mm = p->mm;
+  acquire(&p->lock);
+  p->mm = 0;
+  p->pagetable = 0;
+  release(&p->lock);
+  mmput(mm, p);
+  vforkdone(p);
+
+  // Close all open files, unless other threads share them.
+  fdtput(p->fdt);
+  p->fdt = 0;
 
   begin_op();
   iput(p->cwd);
@@ -388,22 +1080,34 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid, copying its
+// exit status to addr unless addr is 0, and its CPU usage
+// (with its children's) to raddr unless raddr is 0. A child
+// process for wait() and wait4(); for join(), a thread this
+// thread made with clone(); either the one with id tid or, if
+// tid is 0, any. Return -1 if there is no such child, or, with
+// WNOHANG in options, 0 if there is but none has exited.
+static int
+reap(int thread, int tid, uint64 addr, uint64 raddr, int options)
 {
   struct proc *pp;
+  struct rusage ru;
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the status and usage are copied out with locks held.
+  if(addr != 0 && uvmprefault(addr, sizeof(int), 1) < 0)
+    return -1;
+  if(raddr != 0 && uvmprefault(raddr, sizeof(ru), 1) < 0)
+    return -1;
+
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+    for(pp = p->child; pp; pp = pp->sibnext){
+      if(pp->thread == thread && (tid == 0 || pp->pid == tid)){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -421,8 +1125,20 @@ wait(uint64 addr)
             release(&wait_lock);
             return -1;
           }
-          freeproc(pp);
+          memset(&ru, 0, sizeof(ru));
+          ruget(pp, 0, &ru);
+          ruget(pp, 1, &ru);
+          if(raddr != 0 && copyout(p->pagetable, raddr, (char *)&ru, sizeof(ru)) < 0){
+            release(&pp->lock);
+            release(&wait_lock);
+            return -1;
+          }
+          ruadd(p, pp, thread);
+          // pp is off every CPU once its lock is free, and no
+          // one else will reap it.
           release(&pp->lock);
+          disown(pp);
+          freeproc(pp);
           release(&wait_lock);
           return pid;
         }
@@ -436,12 +1152,188 @@ wait(uint64 addr)
       release(&wait_lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&wait_lock);
+      return 0;
+    }
     
     // Wait for a child to exit.
     sleep(p, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(0, 0, addr, 0, 0);
+}
+
+// Wait for child process pid, or any if pid is -1, to exit;
+// see reap() for the rest.
+int
+wait4(int pid, uint64 addr, int options, uint64 raddr)
+{
+  if(pid == 0 || pid < -1 || (options & ~WNOHANG) != 0)
+    return -1;
+  return reap(0, pid == -1 ? 0 : pid, addr, raddr, options);
+}
+
+// Wait for thread tid (any thread if 0) made by this
+// thread's clone() to exit, and return its id.
+int
+join(int tid, uint64 addr)
+{
+  if(tid < 0)
+    return -1;
+  return reap(1, tid, addr, 0, 0);
+}
+
+// Charge the time since p's clock last charged it to *t, and
+// restart the clock. A process's time is charged to utime on
+// entering the kernel, to stime on leaving it and on switching
+// away, and to wtime when it gets a CPU; its clock restarts when
+// it becomes runnable, so time asleep is not charged.
+void
+ruclock(struct proc *p, uint64 *t)
+{
+  uint64 now = r_time();
+
+  *t += now - p->tstamp;
+  p->tstamp = now;
+}
+
+// Charge p the cycles and instructions its CPU has run since
+// p got it, and restart the counts. The counters are per CPU, so
+// p must not move while this runs.
+static void
+rucount(struct proc *p)
+{
+  uint64 cyc = r_cycle(), ins = r_instret();
+
+  p->cycles += cyc - p->cycstamp;
+  p->instret += ins - p->insstamp;
+  p->cycstamp = cyc;
+  p->insstamp = ins;
+}
+
+// p is getting a CPU: charge its wait, and start counting
+// its cycles. Caller holds p->lock.
+static void
+ruswitchin(struct proc *p)
+{
+  ruclock(p, &p->wtime);
+  p->cycstamp = r_cycle();
+  p->insstamp = r_instret();
+}
+
+// p is switching away from its CPU: charge it, and count the
+// switch. Caller holds p->lock.
+static void
+ruswitch(struct proc *p)
+{
+  ruclock(p, &p->stime);
+  rucount(p);
+  if(p->state == SLEEPING)
+    p->nvcsw++;
+  else if(p->state == RUNNABLE)
+    p->nivcsw++;
+}
+
+// Add p's CPU usage to *ru, or the usage of the children
+// p has waited for, if children is set.
+static void
+ruget(struct proc *p, int children, struct rusage *ru)
+{
+  if(children){
+    ru->utime += p->cutime;
+    ru->stime += p->cstime;
+    ru->wtime += p->cwtime;
+    ru->nvcsw += p->cnvcsw;
+    ru->nivcsw += p->cnivcsw;
+    ru->nfault += p->cnfault;
+    ru->nsyscall += p->cnsyscall;
+    ru->cycles += p->ccycles;
+    ru->instret += p->cinstret;
+  } else {
+    ru->utime += p->utime;
+    ru->stime += p->stime;
+    ru->wtime += p->wtime;
+    ru->nvcsw += p->nvcsw;
+    ru->nivcsw += p->nivcsw;
+    ru->nfault += p->nfault;
+    ru->nsyscall += p->nsyscall;
+    ru->cycles += p->cycles;
+    ru->instret += p->instret;
+  }
+}
+
+// Add *ru to p's CPU usage, or to that of its children.
+static void
+ruput(struct proc *p, int children, struct rusage *ru)
+{
+  if(children){
+    p->cutime += ru->utime;
+    p->cstime += ru->stime;
+    p->cwtime += ru->wtime;
+    p->cnvcsw += ru->nvcsw;
+    p->cnivcsw += ru->nivcsw;
+    p->cnfault += ru->nfault;
+    p->cnsyscall += ru->nsyscall;
+    p->ccycles += ru->cycles;
+    p->cinstret += ru->instret;
+  } else {
+    p->utime += ru->utime;
+    p->stime += ru->stime;
+    p->wtime += ru->wtime;
+    p->nvcsw += ru->nvcsw;
+    p->nivcsw += ru->nivcsw;
+    p->nfault += ru->nfault;
+    p->nsyscall += ru->nsyscall;
+    p->cycles += ru->cycles;
+    p->instret += ru->instret;
+  }
+}
+
+// p has reaped pp: charge pp's CPU usage to p as its own if
+// pp was p's thread, or else as its children's; and the usage
+// of pp's children as p's children's.
+static void
+ruadd(struct proc *p, struct proc *pp, int thread)
+{
+  struct rusage ru;
+
+  memset(&ru, 0, sizeof(ru));
+  ruget(pp, 0, &ru);
+  if(thread){
+    ruput(p, 0, &ru);
+    memset(&ru, 0, sizeof(ru));
+  }
+  ruget(pp, 1, &ru);
+  ruput(p, 1, &ru);
+}
+
+// Copy the CPU usage of the caller, or of the children it has
+// waited for, to struct rusage at user address addr.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage ru;
+
+  if(who != RUSAGE_SELF && who != RUSAGE_CHILDREN)
+    return -1;
+  // charge the system call so far.
+  push_off();
+  ruclock(p, &p->stime);
+  rucount(p);
+  pop_off();
+  memset(&ru, 0, sizeof(ru));
+  ruget(p, who == RUSAGE_CHILDREN, &ru);
+  return copyout(p->pagetable, addr, (char *)&ru, sizeof(ru));
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -451,50 +1343,151 @@ wait(uint64 addr)
 //    via swtch back to the scheduler.
 void scheduler(void) {
     struct proc *p;
-    struct proc *high_prio_proc;
     struct cpu *c = mycpu();
     c->proc = 0;
+    c->idlestamp = r_time();
 
     for(;;){
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
 
-        high_prio_proc = 0;
-
-        for(p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if(p->state == RUNNABLE) {
-                // If we haven't selected a process yet, or this process has a higher priority
-                if(high_prio_proc == 0 || p->priority < high_prio_proc->priority) {
-                    if (high_prio_proc != 0) { // if high prio has been initilized already release the lock before updating
-                        release(&high_prio_proc->lock);
-                    }  
-                    high_prio_proc = p; // if high prio proc hasnt been initialized or p has higher priority then update
-                } 
-                else {
-                    release(&p->lock);
-                }
-            } else {
-                release(&p->lock);
-            }
-        }
+        // an unlocked peek, so that idle CPUs don't fight over runq.lock.
+        if(__atomic_load_n(&runq.ready, __ATOMIC_RELAXED) == 0 || (p = pickproc(0)) == 0)
+            continue;
+
+        // Switch to the highest priority process.
+        // No one else can take p off the run queue, but the CPU
+        // that put it there may still hold its lock.
+        acquire(&p->lock);
+        if(p->state != RUNNABLE)
+            panic("scheduler");
+        p->state = RUNNING;
+        ruswitchin(p);
+        c->idle += r_time() - c->idlestamp;
+        c->nswitch++;
+        c->proc = p;
+        c->prev = 0;
+        swtch(&c->context, &p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        // It need not be the one we started: processes switch
+        // directly to each other in sched().
+        p = c->proc;
+        c->proc = 0;
+        release(&p->lock);
+        c->idlestamp = r_time();
+    }
+}
 
-        if (high_prio_proc != 0) {
-            // Switch to the highest priority process.
-            high_prio_proc->state = RUNNING;
-            c->proc = high_prio_proc;
-            swtch(&c->context, &high_prio_proc->context);
+// Put p at the back of the run queue of its priority.
+// Caller must hold runq.lock.
+static void
+runqpush(struct proc *p)
+{
+  int pri = p->priority;
+
+  p->rnext = 0;
+  p->rprev = runq.tail[pri];
+  if(runq.tail[pri])
+    runq.tail[pri]->rnext = p;
+  else
+    runq.head[pri] = p;
+  runq.tail[pri] = p;
+  runq.ready |= 1U << pri;
+  p->queued = 1;
+  runq.len++;
+}
 
-            // Process is done running for now.
-            // It should have changed its p->state before coming back.
-            c->proc = 0;
-            release(&high_prio_proc->lock);
-        }
-    }
+// Take p off its run queue.
+// Caller must hold runq.lock.
+static void
+runqremove(struct proc *p)
+{
+  int pri = p->priority;
+
+  if(p->rprev)
+    p->rprev->rnext = p->rnext;
+  else
+    runq.head[pri] = p->rnext;
+  if(p->rnext)
+    p->rnext->rprev = p->rprev;
+  else
+    runq.tail[pri] = p->rprev;
+  if(runq.head[pri] == 0)
+    runq.ready &= ~(1U << pri);
+  p->queued = 0;
+  runq.len--;
+}
+
+// Make p runnable, and queue it to run.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  p->tstamp = r_time();
+  acquire(&runq.lock);
+  runqpush(p);
+  release(&runq.lock);
 }
 
-// Switch to scheduler.  Must hold only p->lock
-// and have changed proc->state. Saves and restores
+// Take the process to run next off the run queue: the one
+// with the best priority that has waited the longest, so
+// that processes of equal priority take turns. If p, the
+// caller's process, is RUNNABLE (yielding), it competes too:
+// it keeps the CPU, and 0 is returned, unless a queued
+// process has a priority as good or better, in which case
+// p goes on the queue in the same step.
+// Caller holds p->lock, if p is not 0.
+//
+// A CPU that takes a process off the queue then waits for
+// its lock, which the CPU that queued it may not yet have
+// released; since that CPU took its own next process off
+// the queue earlier, the waits cannot form a cycle.
+static struct proc*
+pickproc(struct proc *p)
+{
+  struct proc *best = 0;
+  int pri;
+
+  acquire(&runq.lock);
+  if(runq.ready != 0){
+    // the lowest set bit: at most NPRIO shifts of a register.
+    for(pri = 0; (runq.ready & (1U << pri)) == 0; pri++)
+      ;
+    best = runq.head[pri];
+  }
+  if(best != 0 && p != 0 && p->state == RUNNABLE && p->priority < best->priority)
+    best = 0;
+  if(best != 0){
+    runqremove(best);
+    if(p != 0 && p->state == RUNNABLE)
+      runqpush(p);
+  }
+  release(&runq.lock);
+  return best;
+}
+
+// Finish a direct switch made by sched(): release the lock
+// of the process that switched to us.
+static void
+switchdone(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev = c->prev;
+
+  if(prev != 0){
+    c->prev = 0;
+    release(&prev->lock);
+  }
+}
+
+// Switch to another process.  Must hold only p->lock
+// and have changed proc->state. If some other process
+// is runnable, switch straight to it rather than through
+// the scheduler thread, which would cost a second swtch;
+// the new process releases p->lock (see switchdone()). Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->noff, but that would
@@ -505,6 +1498,8 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc(); // pcb
+  struct proc *np;
+  struct cpu *c;
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -514,13 +1509,37 @@ sched(void)
     panic("sched running");
   if(intr_get())
     panic("sched interruptible");
-
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  if(*(uint64*)p->kstack != KSTACKMAGIC)
+    panic("sched kstack overflow");
+
+  c = mycpu();
+  intena = c->intena;
+  np = pickproc(p);
+  if(np == 0 && p->state == RUNNABLE){
+    // a yield with nothing as good to run: keep going.
+    p->state = RUNNING;
+  } else if(np != 0){
+    acquire(&np->lock);
+    if(np->state != RUNNABLE)
+      panic("sched runnable");
+    np->state = RUNNING;
+    ruswitch(p);
+    ruswitchin(np);
+    c->nswitch++;
+    c->proc = np;
+    c->prev = p;
+    swtch(&p->context, &np->context);
+    switchdone();
+  } else {
+    ruswitch(p);
+    swtch(&p->context, &c->context);
+    switchdone();
+  }
   mycpu()->intena = intena;
 }
 
 // Give up the CPU for one scheduling round.
+// sched() puts p on the run queue, if it gives up the CPU.
 void
 yield(void)
 {
@@ -538,7 +1557,11 @@ forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler or sched(),
+  // and maybe the lock of the process that switched to us.
+  // A new process starts with interrupts on.
+  switchdone();
+  mycpu()->intena = 1;
   release(&myproc()->lock);
 
   if (first) {
@@ -558,28 +1581,44 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = SLEEPQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the queue),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sprev = 0;
+  p->snext = q->head;
+  if(q->head)
+    q->head->sprev = p;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+  acquire(&q->lock);
+  if(p->sprev)
+    p->sprev->snext = p->snext;
+  else
+    q->head = p->snext;
+  if(p->snext)
+    p->snext->sprev = p->sprev;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -589,40 +1628,131 @@ void
 wakeup(void *chan)
 {
   struct proc *p;
+  struct sleepq *q = SLEEPQ(chan);
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->snext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
+}
+
+// Futexes: a thread can sleep until the int at a user address
+// changes, and another thread of the same address space can wake
+// it. A waiting thread sleeps on &mm->futex, a channel no kernel
+// sleep shares, and records the user address in p->futex;
+// futex_lock makes checking the int and going to sleep atomic
+// with respect to futexwake(), which the waker calls after
+// changing the int.
+
+// Sleep on the futex at user address uaddr, unless the int
+// there no longer holds val. Returns 0 when woken (which may
+// be spuriously), -1 if the int did not hold val.
+int
+futexwait(uint64 uaddr, int val)
+{
+  struct proc *p = myproc();
+  int cur;
+
+  if(uaddr % sizeof(int) != 0 || uvmprefault(uaddr, sizeof(int), 0) < 0)
+    return -1;
+
+  acquire(&futex_lock);
+  if(copyin(p->pagetable, (char*)&cur, uaddr, sizeof(cur)) < 0 || cur != val){
+    release(&futex_lock);
+    return -1;
+  }
+  p->futex = uaddr;
+  sleep(&p->mm->futex, &futex_lock);
+  release(&futex_lock);
+  return 0;
+}
+
+// Wake up to n threads sleeping on the futex at user
+// address uaddr. Returns the number woken.
+int
+futexwake(uint64 uaddr, int n)
+{
+  struct proc *pp;
+  struct proc *p = myproc();
+  struct sleepq *q = SLEEPQ(&p->mm->futex);
+  int woken = 0;
+
+  acquire(&futex_lock);
+  acquire(&q->lock);
+  for(pp = q->head; pp && woken < n; pp = pp->snext){
+    if(pp == p)
+      continue;
+    acquire(&pp->lock);
+    if(pp->state == SLEEPING && pp->chan == &p->mm->futex && pp->futex == uaddr){
+      setrunnable(pp);
+      woken++;
+    }
+    release(&pp->lock);
+  }
+  release(&q->lock);
+  release(&futex_lock);
+  return woken;
+}
+
+// Kill the threads other than p that use address space mm,
+// waking those that sleep, and return how many there are.
+// vfork() children borrowing mm are left alone.
+// Caller must hold ptable.lock.
+static int
+killmm(struct proc *p, struct mm *mm)
+{
+  struct proc *q;
+  int n = 0;
+
+  for(q = ptable.all; q; q = q->next){
+    if(q == p)
+      continue;
+    acquire(&q->lock);
+    if(q->mm == mm && q->vfork == 0){
+      q->killed = 1;
+      if(q->state == SLEEPING)
+        setrunnable(q);
+      n++;
+    }
+    release(&q->lock);
+  }
+  return n;
 }
 
-// Kill the process with the given pid.
+// Kill the process with the given pid, and the other
+// threads that share its address space.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
 int
 kill(int pid)
 {
   struct proc *p;
+  struct mm *mm;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
   }
-  return -1;
+  acquire(&p->lock);
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  mm = p->vfork ? 0 : p->mm;
+  release(&p->lock);
+  if(mm)
+    killmm(p, mm);
+  release(&ptable.lock);
+  return 0;
 }
 
 void
@@ -692,9 +1822,7 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
+  for(p = ptable.all; p; p = p->next){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -716,7 +1844,8 @@ pstate(void){
   printf("___________________________________________\n");
   
   // go through page table and print info 
-  for (currentProcPointer = proc; (currentProcPointer < &proc[NPROC]) && currentProcPointer->pid > 0; currentProcPointer++)
+  acquire(&ptable.lock);
+  for (currentProcPointer = ptable.all; currentProcPointer; currentProcPointer = currentProcPointer->next)
   {
     proc_num++;
 
@@ -742,12 +1871,13 @@ pstate(void){
     if (currentProcPointer->pid == 1){
       pname = "(init)";
     }
-    else{
+    else if (currentProcPointer->parent){
       pname = currentProcPointer->parent->name;
     }
 
     printf("%d\t%s\t%s\t%s\n",currentProcPointer->pid, currentProcPointer->name, state, pname);
   }
+  release(&ptable.lock);
   printf("Total processes: %d\n", proc_num);
 
 
@@ -772,7 +1902,8 @@ ps(void){
   printf("___________________________________________\n");
   
   // go through page table and print info 
-  for (currentProcPointer = proc; (currentProcPointer < &proc[NPROC]) && currentProcPointer->pid > 0; currentProcPointer++)
+  acquire(&ptable.lock);
+  for (currentProcPointer = ptable.all; currentProcPointer; currentProcPointer = currentProcPointer->next)
   {
 
     // get the state into readable text
@@ -794,110 +1925,171 @@ ps(void){
 
     printf("%d\t%s\t%s\t%d\n",currentProcPointer->pid, currentProcPointer->name, state, currentProcPointer->priority);
   }
+  release(&ptable.lock);
 }
 
+// Set the priority of process pid, clamped to 0..NPRIO-1.
+// A queued process moves to the back of its new run queue.
 void
 set(int pid, int priority){
-  struct proc *currentProcPointer;
+  struct proc *p;
 
-  // go through page table and find proc with pid
-  for (currentProcPointer = proc; (currentProcPointer < &proc[NPROC]) && currentProcPointer->pid > 0; currentProcPointer++)
-  {
-    if (currentProcPointer->pid == pid){
-      currentProcPointer->priority = priority;
+  if(priority < 0)
+    priority = 0;
+  if(priority >= NPRIO)
+    priority = NPRIO - 1;
+
+  // find proc with pid
+  acquire(&ptable.lock);
+  if ((p = findproc(pid)) != 0){
+    acquire(&p->lock);
+    acquire(&runq.lock);
+    if(p->queued){
+      runqremove(p);
+      p->priority = priority;
+      runqpush(p);
+    } else {
+      p->priority = priority;
     }
+    release(&runq.lock);
+    release(&p->lock);
   }
+  release(&ptable.lock);
 }
 
 
-// sends relevent data about all the proccesses in the page table to userspace
+// Copy records of up to n processes, those with the lowest pids
+// above cursor, to user address addr, and return how many. To
+// see every process, start with cursor 0, then pass the last pid
+// returned, until none come back. Each record is taken with the
+// process's lock held, so it is consistent; they are copied out
+// together once the locks are dropped. ptable.all is in pid order
+// (see allocproc()), so a page starts just after the cursor's
+// process, found through the pid hash; if that process is gone,
+// by walking back from the newest.
 int
-psinfo(struct proc_info *user_buf, struct cpu_info *cpu_user_buf, struct proc_cpu_num *user_num_buf){
-  struct proc *currentProcPointer;
-  int proc_num = 0;
-  char *state = "\0";
-  struct cpu *current_cpu;
-  int cpu_num = 0;
-
-  struct proc_cpu_num kernel_num_buf[2];
-
-  struct proc_info kernel_proc_buf[NPROC];
-  struct cpu_info kernel_cpu_buf[NCPU];
-  
-  // go through page table and print info 
-  for (currentProcPointer = proc; (currentProcPointer < &proc[NPROC]) && currentProcPointer->pid > 0; currentProcPointer++)
-  {
-    state = "\0";
-    // get the state into readable text
-    switch (currentProcPointer->state)
-    {
-    case SLEEPING:
-      state = "SLEEPING";
-      break;
-    case RUNNABLE:
-      state = "RUNNABLE";
-      break;
-    case RUNNING:
-      state = "RUNNING\t";
-      break;
-    
-    default:
-      break;
-    }
-
-    // deal with init having no parent
-    char *pname = "\0";
-    if (currentProcPointer->pid == 1){
-      pname = "(init)";
-    }
-    else{
-      pname = currentProcPointer->parent->name;
-    }
-
-    
-    // store proc info into my kernel_proc_buffer
-    //printf("%d\t%s\t%s\t%s\n",currentProcPointer->pid, currentProcPointer->name, state, pname);
+procsnap(uint64 addr, int cursor, int n)
+{
+  struct procsnap *buf, *r;
+  struct proc *p, *q;
+  struct cpu *c;
+  int i = 0;
 
-    kernel_proc_buf[proc_num].pid = currentProcPointer->pid;
-    strncpy(kernel_proc_buf[proc_num].name, currentProcPointer->name, sizeof(proc->name));
-    strncpy(kernel_proc_buf[proc_num].pName, pname, sizeof(proc->name));
-    strncpy(kernel_proc_buf[proc_num].state, state, sizeof(state));
+  if(n < 0)
+    return -1;
+  if(n > PGSIZE / sizeof(*buf))
+    n = PGSIZE / sizeof(*buf);
+  if((buf = kalloc()) == 0)
+    return -1;
 
-    proc_num++;
+  acquire(&ptable.lock);
+  if(cursor <= 0)
+    p = ptable.all;
+  else if((p = findproc(cursor)) != 0)
+    p = p->next;
+  else {
+    for(q = ptable.last; q && q->pid > cursor; q = q->prev)
+      p = q;
   }
-  kernel_num_buf[0].num = proc_num;
-
-  
-
-
-  // print all cpus with a process running on it with relevent data
-  for (current_cpu = cpus; current_cpu < &cpus[NCPU]; current_cpu++)
-  {
-    if (current_cpu->proc){ // check if process exists on cpu
-      //printf("cpu %d: %s\n", cpu_num, current_cpu->proc->name);
-      kernel_cpu_buf[cpu_num].cpu_num = cpu_num;
-      strncpy(kernel_cpu_buf[cpu_num].name, current_cpu->proc->name, sizeof(proc->name));
-      cpu_num++;
+  for(; p && i < n; p = p->next){
+    r = &buf[i++];
+    memset(r, 0, sizeof(*r));
+    r->version = PROCSNAP_VERSION;
+    acquire(&p->lock);
+    r->pid = p->pid;
+    r->ppid = p->ppid;
+    r->thread = p->thread;
+    r->state = p->state;
+    r->priority = p->priority;
+    // a running p stays on its CPU while we hold its lock.
+    r->cpu = -1;
+    if(p->state == RUNNING){
+      for(c = cpus; c < &cpus[NCPU]; c++)
+        if(c->proc == p)
+          r->cpu = c - cpus;
     }
+    r->utime = p->utime;
+    r->stime = p->stime;
+    // once p has started, p->mm changes only with p->lock held.
+    if(p->state != USED && p->mm)
+      r->memsz = p->mm->sz;
+    if(p->state == SLEEPING)
+      r->chan = (uint64)p->chan;
+    safestrcpy(r->name, p->name, sizeof(r->name));
+    release(&p->lock);
   }
-  kernel_num_buf[1].num = cpu_num; 
+  release(&ptable.lock);
 
-  // copy kernel data to userspace
-  struct proc *p = myproc(); // Get the current process
-  pagetable_t pagetable = p->pagetable; // Access the page table of the process
-
-  if (copyout(pagetable, (uint64)user_buf, (char *)kernel_proc_buf, proc_num * sizeof(struct proc_info)) != 0) {
-      printf("err on copyout");
-  }
+  if(i > 0 && copyout(myproc()->pagetable, addr, (char*)buf, i * sizeof(*buf)) < 0)
+    i = -1;
+  kfree(buf);
+  return i;
+}
 
-  if (copyout(pagetable, (uint64)cpu_user_buf, (char *)kernel_cpu_buf, cpu_num * sizeof(struct cpu_info)) != 0) {
-      printf("err on copyout");
+// Copy records for up to n CPUs, those that have started, to
+// user address addr, and return how many.
+int
+cpustat(uint64 addr, int n)
+{
+  struct cpustat buf[NCPU], *r;
+  struct cpu *c;
+  uint64 stamp;
+  int i = 0;
+
+  for(c = cpus; c < &cpus[NCPU] && i < n; c++){
+    // read without locks; a CPU may be switching as we look.
+    if((stamp = c->idlestamp) == 0)
+      continue;
+    r = &buf[i++];
+    r->cpu = c - cpus;
+    r->runq = runq.len;
+    r->time = r_time();
+    r->idle = c->idle;
+    if(c->proc == 0)
+      r->idle += r->time - stamp;   // idle now
+    r->nswitch = c->nswitch;
   }
+  if(i > 0 && copyout(myproc()->pagetable, addr, (char*)buf, i * sizeof(buf[0])) < 0)
+    return -1;
+  return i;
+}
 
-  if (copyout(pagetable, (uint64)user_num_buf, (char *)kernel_num_buf, 2 * sizeof(struct proc_cpu_num)) != 0) {
-      printf("err on copyout");
+// Rewrite the kernel statistics page, at each clock tick.
+// Only CPU 0 calls this, with interrupts off, so there is one
+// writer; readers in user space retry if seq is odd or moves
+// while they read. Counters are read without their locks.
+void
+kstatstick(void)
+{
+  struct kstatcpu *r;
+  struct meminfo mi;
+  struct cpu *c;
+  uint64 stamp;
+  int i;
+
+  kmeminfo(&mi);
+
+  kstats->seq++;
+  __sync_synchronize();
+  kstats->ticks = ticks;
+  kstats->time = r_time();
+  kstats->nproc = ptable.n;
+  kstats->nrunnable = runq.len;
+  kstats->freepages = mi.nfree;
+  kstats->ncpu = 0;
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    if((stamp = c->idlestamp) == 0)
+      continue;
+    kstats->ncpu = i + 1;
+    r = &kstats->cpu[i];
+    r->idle = c->idle;
+    if(c->proc == 0)
+      r->idle += kstats->time - stamp;   // idle now
+    r->nswitch = c->nswitch;
+    r->nsyscall = c->nsyscall;
+    r->nintr = c->nintr;
   }
-
-  return proc_num;
-  
-}
\ No newline at end of file
+  __sync_synchronize();
+  kstats->seq++;
+}
@@ -22,21 +22,26 @@ struct context {
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
+  struct proc *prev;          // Switched away from by sched(); its lock is still held.
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
-};
-
-struct cpu_info
-{
-  char name[16]; // name of process running on cpu
-  int cpu_num;
+  uint64 uepoch;              // Odd while in user space; see mmsync().
+  uint64 asidgen;             // Generation of the ASIDs handed out; see mmasid().
+  uint64 asidnext;            // Next ASID to hand out.
+  uint64 idlestamp;           // time CSR when scheduler() last went idle; 0 until it starts
+  uint64 idle;                // Time scheduler() has had nothing to run
+  uint64 nswitch;             // Switches to a process
+  uint64 nsyscall;            // System calls, counted by usertrap()
+  uint64 nintr;               // Device interrupts, counted by devintr()
+  uint64 nexttick;            // time CSR of the next clock tick; see devintr()
 };
 
 extern struct cpu cpus[NCPU];
 
-// per-process data for the trap handling code in trampoline.S.
-// sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// per-thread data for the trap handling code in trampoline.S.
+// sits in a page by itself at p->tfva, under the trampoline page
+// in the user page table; threads that share a page table each
+// have their own. not specially mapped in the kernel page table.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
@@ -85,6 +90,49 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory mapped from a file or a memfd by
+// mmap(), or a segment of the program loaded by exec().
+// Pages are filled in on demand by vmafault().
+struct vma {
+  uint64 start;                // First address; page-aligned
+  uint64 end;                  // One past the last address
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, VMA_IMAGE
+  struct inode *ip;            // Mapped file, or
+  struct shm *shm;             // mapped memfd; both 0 if the slot is free
+  uint off;                    // File offset of start
+  uint64 filesz;               // Bytes from start backed by the file;
+                               // the rest of the region reads as zeros
+};
+
+// vma flags, besides those of mmap().
+// Pages of a VMA_IMAGE region lie below p->sz and belong to
+// the process's ordinary memory once faulted in: fork() copies
+// them and exit() frees them with the rest of p->sz.
+#define VMA_IMAGE 0x100
+
+// A user address space, shared by the threads of a process.
+// lock serializes changes to the page table and the regions
+// (page faults, mmap(), sbrk(), fork()); it may be held while
+// taking inode locks and starting file system operations, so
+// user memory must not be faulted in with those held.
+struct mm {
+  struct sleeplock lock;
+  int ref;                     // Threads using it; under mm_lock in proc.c
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // mmap()ed regions
+  uint64 asid[NCPU];           // Per-CPU generation and ASID; see mmasid()
+  char futex;                  // Futex waiters sleep on its address; see futexwait()
+};
+
+// Open files, shared by the threads of a process.
+struct fdtable {
+  struct spinlock lock;
+  int ref;                     // Threads using it
+  struct file *ofile[NOFILE];  // Open files
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -98,31 +146,67 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
   int priority;                // Process Priority 
+  int ppid;                    // Parent's pid, for procsnap(); see adopt()
 
-  // wait_lock must be held when using this:
+  // ptable.lock must be held when using these:
+  struct proc *next;           // All processes
+  struct proc *prev;
+  struct proc *hnext;          // Pid hash chain
+
+  // runq.lock must be held when using these:
+  struct proc *rnext;          // Run queue of its priority
+  struct proc *rprev;
+  int queued;                  // On a run queue
+
+  // the lock of p->chan's sleep queue must be held when using these:
+  struct proc *snext;          // Sleep queue
+  struct proc *sprev;
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *child;          // First child
+  struct proc *sibnext;        // Parent's other children
+  struct proc *sibprev;
+  int thread;                  // Made by clone(); reaped by join(), not wait(); also p->lock
+  int vfork;                   // Made by vfork(); parent waits until it execs
+
+  // futex_lock must be held when using this:
+  uint64 futex;                // User address of the futex it waits on
+
+  // CPU usage, for getrusage(); see ruclock(). charged by the
+  // process itself, or with p->lock held while it is not running.
+  uint64 tstamp;               // time CSR when the clock last charged p
+  uint64 cycstamp;             // cycle CSR when p last got its CPU
+  uint64 insstamp;             // instret CSR when p last got its CPU
+  uint64 utime;                // Time in user space
+  uint64 stime;                // Time in the kernel
+  uint64 wtime;                // Time runnable, waiting for a CPU
+  uint64 nvcsw;                // Switches away to sleep
+  uint64 nivcsw;               // Switches away while still runnable
+  uint64 nfault;               // Page faults
+  uint64 nsyscall;             // System calls
+  uint64 cycles;               // Cycles on a CPU
+  uint64 instret;              // Instructions retired on a CPU
+  uint64 cutime;               // Totals of the children waited for
+  uint64 cstime;
+  uint64 cwtime;
+  uint64 cnvcsw;
+  uint64 cnivcsw;
+  uint64 cnfault;
+  uint64 cnsyscall;
+  uint64 ccycles;
+  uint64 cinstret;
 
   // these are private to the process, so p->lock need not be held.
-  uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 kstack;               // Kernel stack page
+  struct mm *mm;               // Address space, shared with clone()d threads
+  pagetable_t pagetable;       // User page table; mm->pagetable
+  struct fdtable *fdt;         // Open files, shared with clone()d threads
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User virtual address of trapframe
+  int nsleep;                  // Sleep-locks held; see uvmaccess()
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-};
-
-struct proc_info
-{
-  char name[16];
-  char pName[16]; // parent name
-  char state[9]; // running, runnable, sleeping
-  int pid;
-};
-
-
-struct proc_cpu_num
-{
-  int num;
+  void (*kfn)(void);           // Body of a kernel thread (see kproc)
 };
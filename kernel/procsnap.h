@@ -0,0 +1,28 @@
+// Process records, from the procsnap() system call.
+// Both the kernel and user programs use this header file.
+
+// bumped when struct procsnap changes.
+#define PROCSNAP_VERSION 1
+
+struct procsnap {
+  int version;                  // PROCSNAP_VERSION
+  int pid;
+  int ppid;                     // parent's pid, or 0 if none
+  int state;                    // PS_ below
+  int priority;                 // lower runs first
+  int cpu;                      // CPU running it, or -1
+  int thread;                   // made by clone()
+  int pad;
+  uint64 utime;                 // time CSR ticks in user space
+  uint64 stime;                 // time CSR ticks in the kernel
+  uint64 memsz;                 // bytes of user memory, below the break
+  uint64 chan;                  // kernel address it sleeps on, or 0
+  char name[16];
+};
+
+// states, as in the kernel's enum procstate.
+#define PS_USED      1          // being created
+#define PS_SLEEPING  2
+#define PS_RUNNABLE  3
+#define PS_RUNNING   4
+#define PS_ZOMBIE    5
@@ -0,0 +1,242 @@
+// Sampling profiler.
+//
+// While profctl() has profiling on, the timer interrupts each
+// CPU every PROFCYCLES rather than every TICKCYCLES, and at
+// each interrupt the CPU records where it was: the process,
+// the interrupted pc, and the return addresses found by
+// following the frame pointers (the kernel and user programs
+// are compiled with -fno-omit-frame-pointer), first on the
+// kernel stack, then on the user stack of the process the
+// kernel was running for. Each CPU has a ring of samples of
+// its own; profread() drains them. A full ring drops new
+// samples rather than old ones, and counts them.
+//
+// One profiler at a time: the process that turns profiling on
+// owns it, and profctl() from any other fails until the owner
+// turns it off or exits. profctl() clears the rings.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFBUF 256    // samples in each CPU's ring
+
+struct profbuf {
+  struct spinlock lock;
+  uint r;               // samples read
+  uint w;               // samples written; w - r wait to be read
+  int dropped;          // samples lost to a full ring
+  struct profsample s[NPROFBUF];
+};
+
+static struct profbuf profbufs[NCPU];
+static int profon;
+static int owner;       // pid of the process that turned profiling on
+static struct spinlock ctllock;   // protects profon and owner
+
+extern char etext[];  // kernel.ld sets this to end of kernel code.
+extern uint64 timer_scratch[NCPU][5];   // in start.c
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&profbufs[i].lock, "prof");
+  initlock(&ctllock, "profctl");
+}
+
+// Record the kernel pc and the return addresses on the kernel
+// stack above frame pointer fp. A kernel stack is one page, so
+// a frame pointer off that page ends the chain, as does a
+// return address outside the kernel's code; the frame of a
+// leaf function, which need not save ra, stops it early.
+static void
+kbacktrace(struct profsample *s, uint64 pc, uint64 fp)
+{
+  uint64 lo = PGROUNDDOWN(fp - 1), ra;
+
+  s->pc[s->npc++] = pc;
+  while(s->npc < NPROFPC && fp % 8 == 0 && fp >= lo + 16 && fp <= lo + PGSIZE){
+    ra = *(uint64*)(fp - 8);
+    if(ra < KERNBASE || ra >= (uint64)etext)
+      break;
+    s->pc[s->npc++] = ra;
+    if(*(uint64*)(fp - 16) <= fp)
+      break;
+    fp = *(uint64*)(fp - 16);
+  }
+}
+
+// Read the 8 bytes at user address va, without faulting or
+// sleeping, as an interrupt handler must. Returns -1 if va
+// is not mapped.
+static int
+fetchuser(pagetable_t pagetable, uint64 va, uint64 *x)
+{
+  uint64 pa;
+
+  if(va % 8 != 0 || (pa = walkaddr(pagetable, va)) == 0)
+    return -1;
+  *x = *(uint64*)(pa + va % PGSIZE);
+  return 0;
+}
+
+// Record the user pc and the return addresses on the user
+// stack above frame pointer fp.
+static void
+ubacktrace(struct profsample *s, pagetable_t pagetable, uint64 pc, uint64 fp)
+{
+  uint64 ra, next;
+
+  if(s->npc >= NPROFPC)
+    return;
+  s->pc[s->npc++] = pc;
+  while(s->npc < NPROFPC && fetchuser(pagetable, fp - 8, &ra) == 0 && ra != 0){
+    s->pc[s->npc++] = ra;
+    if(fetchuser(pagetable, fp - 16, &next) < 0 || next <= fp)
+      break;
+    fp = next;
+  }
+}
+
+// Take a sample at a timer interrupt, if profiling is on.
+// pc and fp are the interrupted pc and frame pointer: in
+// user space if user is set, else in the kernel.
+// Interrupts are off.
+void
+profsample(uint64 pc, uint64 fp, int user)
+{
+  struct proc *p = myproc();
+  struct profbuf *b;
+  struct profsample *s;
+
+  if(!profon)
+    return;
+  b = &profbufs[cpuid()];
+  acquire(&b->lock);
+  if(b->w - b->r >= NPROFBUF){
+    b->dropped++;
+    release(&b->lock);
+    return;
+  }
+  s = &b->s[b->w % NPROFBUF];
+  s->pid = p ? p->pid : 0;
+  s->cpu = cpuid();
+  safestrcpy(s->name, p ? p->name : "scheduler", sizeof(s->name));
+  s->npc = 0;
+  if(!user)
+    kbacktrace(s, pc, fp);
+  s->nkernel = s->npc;
+  // the process's user code, which the kernel is running for.
+  // p->pagetable is 0 once exit() has let go of the memory.
+  if(p && p->pagetable){
+    if(user)
+      ubacktrace(s, p->pagetable, pc, fp);
+    else
+      ubacktrace(s, p->pagetable, p->trapframe->epc, p->trapframe->s0);
+  }
+  b->w++;
+  release(&b->lock);
+}
+
+// Turn profiling on, clearing the rings, or off, and return the
+// number of samples dropped since it was last turned on.
+// Caller must hold ctllock.
+static int
+profset(int on)
+{
+  struct profbuf *b;
+  int dropped = 0;
+
+  if(!on)
+    profon = 0;
+  for(b = profbufs; b < &profbufs[NCPU]; b++){
+    acquire(&b->lock);
+    dropped += b->dropped;
+    if(on)
+      b->r = b->w = b->dropped = 0;
+    release(&b->lock);
+  }
+  if(on)
+    profon = 1;
+
+  // timervec reads the interval afresh at each interrupt, so
+  // the new rate starts after the next one. devintr() still
+  // counts a tick every TICKCYCLES.
+  for(int i = 0; i < NCPU; i++)
+    timer_scratch[i][4] = on ? PROFCYCLES : TICKCYCLES;
+  return dropped;
+}
+
+// Turn profiling on or off for the calling process; see
+// profset(). Returns -1 if another process has it on.
+int
+profctl(int on)
+{
+  int pid = myproc()->pid;
+  int dropped;
+
+  acquire(&ctllock);
+  if(profon && owner != pid){
+    release(&ctllock);
+    return -1;
+  }
+  owner = on ? pid : 0;
+  dropped = profset(on);
+  release(&ctllock);
+  return dropped;
+}
+
+// Process p is exiting: if it turned profiling on, turn it
+// off, so that the timer does not go on interrupting at the
+// profiling rate with no one to read the samples.
+void
+profexit(struct proc *p)
+{
+  if(!profon)
+    return;
+  acquire(&ctllock);
+  if(profon && owner == p->pid){
+    owner = 0;
+    profset(0);
+  }
+  release(&ctllock);
+}
+
+// Move up to n samples, oldest first from each CPU, to user
+// address addr; return how many.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample *buf;
+  struct profbuf *b;
+  int m, got = 0;
+
+  if(n < 0 || (buf = (struct profsample*)kalloc()) == 0)
+    return -1;
+  for(b = profbufs; b < &profbufs[NCPU] && got < n; b++){
+    for(;;){
+      // copy out of the ring with the lock released, since
+      // copyout() may fault in the user's page.
+      acquire(&b->lock);
+      for(m = 0; m < PGSIZE / sizeof(*buf) && got + m < n && b->r != b->w; m++)
+        buf[m] = b->s[b->r++ % NPROFBUF];
+      release(&b->lock);
+      if(m == 0)
+        break;
+      if(copyout(myproc()->pagetable, addr + got * sizeof(*buf), (char*)buf, m * sizeof(*buf)) < 0){
+        kfree(buf);
+        return -1;
+      }
+      got += m;
+    }
+  }
+  kfree(buf);
+  return got;
+}
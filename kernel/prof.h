@@ -0,0 +1,15 @@
+// Samples of what the CPUs were running, taken at timer
+// interrupts while profctl() has profiling on, from the
+// profread() system call.
+// Both the kernel and user programs use this header file.
+
+#define NPROFPC 12              // deepest stack a sample records
+
+struct profsample {
+  int pid;                      // process interrupted, or 0 in scheduler()
+  int cpu;
+  int npc;                      // entries in pc[]
+  int nkernel;                  // of which the first nkernel are in the kernel
+  uint64 pc[NPROFPC];           // where interrupted, then return addresses, innermost first
+  char name[16];                // process name, for its symbols in /name.sym
+};
@@ -0,0 +1,20 @@
+// CPU usage, from the getrusage() and wait4() system calls.
+// Both the kernel and user programs use this header file.
+// Times are in ticks of the time CSR, which qemu's virt
+// board runs at 10 MHz.
+
+struct rusage {
+  uint64 utime;                 // time running in user space
+  uint64 stime;                 // time running in the kernel
+  uint64 wtime;                 // time runnable, waiting for a CPU
+  uint64 nvcsw;                 // switches away to sleep
+  uint64 nivcsw;                // switches away while still runnable
+  uint64 nfault;                // page faults
+  uint64 nsyscall;              // system calls
+  uint64 cycles;                // clock cycles on a CPU, user and kernel
+  uint64 instret;               // instructions retired on a CPU
+};
+
+// getrusage() who.
+#define RUSAGE_SELF       0     // the caller, and the threads it has joined
+#define RUSAGE_CHILDREN  -1     // the children it has waited for, and theirs
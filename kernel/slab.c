@@ -0,0 +1,258 @@
+// Slab allocator, for fixed-size kernel objects such as
+// struct file, struct inode and struct pipe, so that they
+// take only as much memory as they need and their number
+// is limited only by memory.
+//
+// A cache hands out objects of one size. It carves them out
+// of slabs: blocks of 2^order pages from kalloc_pages(), each
+// a struct slab followed by the objects. Buddy blocks are
+// aligned to their size, so an object's slab is found by
+// rounding its address down. A slab with free objects is on
+// the cache's partial list, and a slab with none is on its
+// full list. A slab whose objects are all free goes back to
+// kalloc, except that the cache keeps one as a spare.
+//
+// In front of the slabs, each CPU has a magazine of free
+// objects, which it can take from and add to without the
+// cache's lock; the magazine's own lock is only contended
+// by kcache_reap(). An empty magazine is half filled, and a
+// full one half emptied, under the cache's lock.
+//
+// When kalloc runs out of memory it calls kcache_reap(),
+// which gives back the pages of free objects.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  struct kcache *cache;
+  void *free;         // free objects, linked through their first word
+  int inuse;          // objects not on free
+};
+
+#define OBJ2SLAB(c, o) ((struct slab*)((uint64)(o) & ~((PGSIZE << (c)->order) - 1)))
+
+// all caches. they are made while the kernel boots,
+// so the list needs no lock.
+static struct kcache *caches;
+
+// set buf, of 16 bytes, to name followed by suffix.
+static void
+lockname(char *buf, char *name, char *suffix)
+{
+  int n;
+
+  safestrcpy(buf, name, 16);
+  n = strlen(buf);
+  safestrcpy(buf + n, suffix, 16 - n);
+}
+
+void
+kcache_init(struct kcache *c, char *name, uint size)
+{
+  int k;
+
+  // named apart from the locks in the objects, such as "proc".
+  lockname(c->lockname, name, ".slab");
+  lockname(c->magname, name, ".mag");
+  initlock(&c->lock, c->lockname);
+  for(k = 0; k < NCPU; k++)
+    initlock(&c->mag[k].lock, c->magname);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  if(c->size < sizeof(void*))
+    c->size = sizeof(void*);
+  // the smallest slab that holds at least 8 objects.
+  for(k = 0; k < MAXORDER; k++)
+    if((PGSIZE << k) - sizeof(struct slab) >= 8 * c->size)
+      break;
+  c->order = k;
+  c->perslab = ((PGSIZE << k) - sizeof(struct slab)) / c->size;
+  if(c->perslab < 1)
+    panic("kcache_init");
+  c->partial = c->full = c->spare = 0;
+  c->next = caches;
+  caches = c;
+}
+
+static void
+slabpush(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static void
+slabremove(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate a slab and put all its objects on its free list.
+static struct slab*
+newslab(struct kcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = kalloc_pages(c->order)) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  o = (char*)s + sizeof(struct slab);
+  for(i = c->perslab - 1; i >= 0; i--){
+    *(void**)(o + i*c->size) = s->free;
+    s->free = o + i*c->size;
+  }
+  return s;
+}
+
+// Take an object from a slab, allocating a slab if need be.
+// Caller holds c->lock.
+static void*
+getobj(struct kcache *c)
+{
+  struct slab *s;
+  void *o;
+
+  if((s = c->partial) == 0){
+    if((s = c->spare) != 0)
+      c->spare = 0;
+    else if((s = newslab(c)) == 0)
+      return 0;
+    slabpush(&c->partial, s);
+  }
+  o = s->free;
+  s->free = *(void**)o;
+  if(++s->inuse == c->perslab){
+    slabremove(&c->partial, s);
+    slabpush(&c->full, s);
+  }
+  return o;
+}
+
+// Give an object back to its slab.
+// Caller holds c->lock.
+static void
+putobj(struct kcache *c, void *o)
+{
+  struct slab *s = OBJ2SLAB(c, o);
+
+  if(s->cache != c || s->inuse < 1)
+    panic("kcache_free");
+  if(s->inuse-- == c->perslab){
+    slabremove(&c->full, s);
+    slabpush(&c->partial, s);
+  }
+  *(void**)o = s->free;
+  s->free = o;
+  if(s->inuse == 0){
+    slabremove(&c->partial, s);
+    if(c->spare == 0)
+      c->spare = s;
+    else
+      kfree_pages(s, c->order);
+  }
+}
+
+// Allocate a zeroed object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kcache_alloc(struct kcache *c)
+{
+  struct magazine *m;
+  void *o;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2 && (o = getobj(c)) != 0)
+      m->obj[m->n++] = o;
+    release(&c->lock);
+  }
+  o = m->n > 0 ? m->obj[--m->n] : 0;
+  release(&m->lock);
+  pop_off();
+
+  if(o)
+    memset(o, 0, c->size);
+  return o;
+}
+
+// Free an object that came from kcache_alloc(c).
+void
+kcache_free(struct kcache *c, void *o)
+{
+  struct magazine *m;
+
+  if(OBJ2SLAB(c, o)->cache != c)
+    panic("kcache_free");
+
+  // Fill with junk to catch dangling refs.
+  memset(o, 1, c->size);
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      putobj(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  release(&m->lock);
+  pop_off();
+}
+
+// Give the pages of free objects back to kalloc: empty the
+// magazines into their slabs, which frees the slabs left with
+// no objects in use, and free the spare slabs. The caller
+// may hold some of these locks (kalloc_pages() may be called
+// from getobj()), so this only tries them, and skips what it
+// cannot get.
+void
+kcache_reap(void)
+{
+  struct kcache *c;
+  struct magazine *m;
+  int i;
+
+  push_off();
+  for(c = caches; c; c = c->next){
+    if(holding(&c->lock) || !tryacquire(&c->lock))
+      continue;
+    for(i = 0; i < NCPU; i++){
+      m = &c->mag[i];
+      if(holding(&m->lock) || !tryacquire(&m->lock))
+        continue;
+      while(m->n > 0)
+        putobj(c, m->obj[--m->n]);
+      release(&m->lock);
+    }
+    if(c->spare){
+      kfree_pages(c->spare, c->order);
+      c->spare = 0;
+    }
+    release(&c->lock);
+  }
+  pop_off();
+}
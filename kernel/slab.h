@@ -0,0 +1,28 @@
+// A cache of fixed-size kernel objects; see slab.c.
+
+#define MAGSIZE 16  // free objects a CPU keeps for itself
+
+struct slab;
+
+// a CPU's own stack of free objects. only kcache_reap()
+// takes another CPU's magazine lock.
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kcache {
+  struct spinlock lock;
+  char *name;
+  char lockname[16];      // "name.slab", lock's name for lockstat()
+  char magname[16];       // "name.mag", the magazines' locks' name
+  uint size;              // bytes per object
+  int order;              // a slab is 2^order pages
+  int perslab;            // objects per slab
+  struct slab *partial;   // slabs with some objects free
+  struct slab *full;      // slabs with no objects free
+  struct slab *spare;     // an empty slab, kept for the next allocation
+  struct magazine mag[NCPU];
+  struct kcache *next;    // list of all caches, for kcache_reap()
+};
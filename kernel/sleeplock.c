@@ -6,27 +6,56 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
+
+// the class of the spinlock inside every sleep-lock.
+static struct lockclass *innerclass;
+
+void
+sleeplockinit(void)
+{
+  innerclass = lockclass("sleep lock", 0);
+}
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  initsleeplockclass(lk, name, lockclass(name, 1));
+}
+
+// initsleeplock() with class c, from lockclass(name, 1);
+// see initlockclass().
+void
+initsleeplockclass(struct sleeplock *lk, char *name, struct lockclass *c)
+{
+  initlockclass(&lk->lk, "sleep lock", innerclass);
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->class = c;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int contended = 0;
+  uint64 t0 = 0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  if(lk->locked){
+    // count the time spent asleep.
+    contended = 1;
+    t0 = r_time();
+    while (lk->locked) {
+      sleep(lk, &lk->lk);
+    }
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  myproc()->nsleep++;
+  lk->stamp = r_time();
+  lockacquired(lk->class, contended, lk->stamp - t0);
   release(&lk->lk);
 }
 
@@ -34,8 +63,10 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lockreleased(lk->class, r_time() - lk->stamp);
   lk->locked = 0;
   lk->pid = 0;
+  myproc()->nsleep--;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -6,5 +6,9 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For lockstat():
+  struct lockclass *class;  // Locks of the same name; 0 if not counted.
+  uint64 stamp;      // time CSR when acquired.
 };
 
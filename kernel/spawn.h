@@ -0,0 +1,19 @@
+// spawn() file actions.
+// Both the kernel and user programs use this header file.
+
+// A file action changes the child's copy of the caller's open
+// files before the child starts. spawn() takes an array of them,
+// ended by one whose op is 0, and applies them in order.
+struct spawnact {
+  int op;
+  int fd;
+  int newfd;        // SPAWN_DUP2: make newfd a copy of fd
+  int mode;         // SPAWN_OPEN: open() mode
+  char *path;       // SPAWN_OPEN: file to open as fd
+};
+
+#define SPAWN_CLOSE  1   // close fd
+#define SPAWN_DUP2   2   // close newfd, then make it a copy of fd
+#define SPAWN_OPEN   3   // close fd, then open path as fd
+
+#define NSPAWNACT   16   // most file actions for one spawn()
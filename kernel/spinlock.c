@@ -5,15 +5,111 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+// Lock classes, for lockstat(). Locks are counted by the name
+// they are initialized with. Each CPU counts in a cache line
+// of its own, with interrupts off, so counting needs no atomic
+// instructions and does not bounce lines between CPUs; the
+// counts are summed only when read.
+#define NLOCKCLASS 64
+
+struct lockcount {
+  uint64 nacquire;
+  uint64 ncontend;
+  uint64 wait;        // spinlocks: cycles; sleep-locks: time CSR ticks
+  uint64 maxhold;
+} __attribute__((aligned(64)));
+
+struct lockclass {
+  char *name;
+  int sleep;          // for sleep-locks
+  struct lockcount cpu[NCPU];
+};
+
+static struct lockclass classes[NLOCKCLASS];
+static int nclasses;
+
+// protects classes[] and nclasses. not itself counted, so not
+// set up by initlock().
+static struct spinlock classlock = { .name = "lockclass" };
+
+// Find or make the class of locks named name. Returns 0 if
+// there are too many classes, and the lock goes uncounted.
+struct lockclass*
+lockclass(char *name, int sleep)
+{
+  struct lockclass *c;
+
+  acquire(&classlock);
+  for(c = classes; c < &classes[nclasses]; c++){
+    // as long a name as lockstat() reports.
+    if(c->sleep == sleep && (c->name == name ||
+       strncmp(c->name, name, sizeof(((struct lockstat*)0)->name) - 1) == 0)){
+      release(&classlock);
+      return c;
+    }
+  }
+  c = 0;
+  if(nclasses < NLOCKCLASS){
+    c = &classes[nclasses++];
+    c->name = name;
+    c->sleep = sleep;
+  }
+  release(&classlock);
+  return c;
+}
+
+// Count an acquisition of a lock of class c, which waited
+// for wait if contended. Interrupts must be off.
+void
+lockacquired(struct lockclass *c, int contended, uint64 wait)
+{
+  struct lockcount *n;
+
+  if(c == 0)
+    return;
+  n = &c->cpu[cpuid()];
+  n->nacquire++;
+  if(contended){
+    n->ncontend++;
+    n->wait += wait;
+  }
+}
+
+// Count the release of a lock of class c, held for hold.
+// Interrupts must be off.
+void
+lockreleased(struct lockclass *c, uint64 hold)
+{
+  struct lockcount *n;
+
+  if(c == 0)
+    return;
+  n = &c->cpu[cpuid()];
+  if(hold > n->maxhold)
+    n->maxhold = hold;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
+{
+  initlockclass(lk, name, lockclass(name, 0));
+}
+
+// initlock() with class c, which the caller looked up once
+// with lockclass(); for locks made often, such as the lock of
+// each process, which should not search the classes each time.
+void
+initlockclass(struct spinlock *lk, char *name, struct lockclass *c)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->class = c;
 }
 
 // Acquire the lock.
@@ -21,6 +117,9 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int contended = 0;
+  uint64 t0 = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
@@ -29,8 +128,13 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    // another CPU holds it; count the cycles spent spinning.
+    contended = 1;
+    t0 = r_cycle();
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      ;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +144,28 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->stamp = r_cycle();
+  lockacquired(lk->class, contended, lk->stamp - t0);
+}
+
+// Acquire the lock if it is free, without spinning.
+// Returns 1 if it was acquired, 0 if another CPU holds it.
+int
+tryacquire(struct spinlock *lk)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holding(lk))
+    panic("tryacquire");
+
+  if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  lk->stamp = r_cycle();
+  lockacquired(lk->class, 0, 0);
+  return 1;
 }
 
 // Release the lock.
@@ -49,6 +175,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lockreleased(lk->class, r_cycle() - lk->stamp);
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -108,3 +235,42 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy the counts of up to n lock classes, summed over the
+// CPUs, to user address addr, and return how many. With
+// LOCKSTAT_RESET, zero the counts of every class; a CPU
+// counting meanwhile may lose a count.
+int
+lockstat(uint64 addr, int n, int flags)
+{
+  struct lockstat *buf, *r;
+  struct lockclass *c;
+  struct lockcount *k;
+  int i = 0;
+
+  if(n < 0 || (buf = (struct lockstat*)kalloc()) == 0)
+    return -1;
+  acquire(&classlock);
+  for(c = classes; c < &classes[nclasses]; c++){
+    if(i < n && i < PGSIZE / sizeof(*buf)){
+      r = &buf[i++];
+      memset(r, 0, sizeof(*r));
+      safestrcpy(r->name, c->name, sizeof(r->name));
+      r->sleep = c->sleep;
+      for(k = c->cpu; k < &c->cpu[NCPU]; k++){
+        r->nacquire += k->nacquire;
+        r->ncontend += k->ncontend;
+        r->wait += k->wait;
+        if(k->maxhold > r->maxhold)
+          r->maxhold = k->maxhold;
+      }
+    }
+    if(flags & LOCKSTAT_RESET)
+      memset(c->cpu, 0, sizeof(c->cpu));
+  }
+  release(&classlock);
+  if(i > 0 && copyout(myproc()->pagetable, addr, (char*)buf, i * sizeof(*buf)) < 0)
+    i = -1;
+  kfree(buf);
+  return i;
+}
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat():
+  struct lockclass *class;  // Locks of the same name; 0 if not counted.
+  uint64 stamp;      // cycle CSR when acquired.
 };
 
@@ -43,6 +43,12 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor and user mode read the time CSR (rdtime),
+  // for timing without a system call, and supervisor mode the
+  // cycle and instret CSRs, to count them for each process.
+  w_mcounteren(r_mcounteren() | 7);
+  w_scounteren(r_scounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -66,7 +72,7 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = TICKCYCLES;
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
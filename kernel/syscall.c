@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -12,7 +13,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -104,7 +105,27 @@ extern uint64 sys_close(void);
 extern uint64 sys_pstate(void);
 extern uint64 sys_ps(void);
 extern uint64 sys_set(void);
-extern uint64 sys_psinfo(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_memfd(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_meminfo(void);
+extern uint64 sys_waitpid(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_wait4(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_procsnap(void);
+extern uint64 sys_cpustat(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_lockstat(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -133,7 +154,27 @@ static uint64 (*syscalls[])(void) = {
 [SYS_pstate]  sys_pstate,
 [SYS_ps]      sys_ps,
 [SYS_set]     sys_set,
-[SYS_psinfo]  sys_psinfo,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_memfd]   sys_memfd,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_meminfo] sys_meminfo,
+[SYS_waitpid] sys_waitpid,
+[SYS_spawn]   sys_spawn,
+[SYS_vfork]   sys_vfork,
+[SYS_wait4]   sys_wait4,
+[SYS_getrusage] sys_getrusage,
+[SYS_procsnap] sys_procsnap,
+[SYS_cpustat] sys_cpustat,
+[SYS_profctl] sys_profctl,
+[SYS_profread] sys_profread,
+[SYS_lockstat] sys_lockstat,
 };
 
 void
@@ -143,6 +184,7 @@ syscall(void)
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
+  p->nsyscall++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
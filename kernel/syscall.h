@@ -23,4 +23,24 @@
 #define SYS_pstate 22 
 #define SYS_ps     23 
 #define SYS_set    24 
-#define SYS_psinfo 25 
\ No newline at end of file
+#define SYS_readv  26
+#define SYS_writev 27
+#define SYS_pread  28
+#define SYS_pwrite 29
+#define SYS_mmap   30
+#define SYS_munmap 31 
+#define SYS_memfd  32
+#define SYS_clone  33
+#define SYS_join   34
+#define SYS_futex  35
+#define SYS_meminfo 36
+#define SYS_waitpid 37
+#define SYS_spawn  38
+#define SYS_vfork  39
+#define SYS_wait4  40
+#define SYS_getrusage 41
+#define SYS_procsnap 42
+#define SYS_cpustat 43
+#define SYS_profctl 44
+#define SYS_profread 45
+#define SYS_lockstat 46
\ No newline at end of file
@@ -10,27 +10,41 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "mman.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The caller gets a new reference to the file, and must fileclose()
+// it when done, so that another thread's close() cannot free it.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct fdtable *fdt = myproc()->fdt;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&fdt->lock);
+  if((f = fdt->ofile[fd]) != 0)
+    filedup(f);
+  release(&fdt->lock);
+  if(f == 0)
     return -1;
   if(pfd)
     *pfd = fd;
   if(pf)
     *pf = f;
+  else
+    fileclose(f);
   return 0;
 }
 
@@ -40,17 +54,35 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *fdt = myproc()->fdt;
 
+  acquire(&fdt->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fdt->ofile[fd] == 0){
+      fdt->ofile[fd] = f;
+      release(&fdt->lock);
       return fd;
     }
   }
+  release(&fdt->lock);
   return -1;
 }
 
+// Free file descriptor fd, and return its file, whose
+// reference passes to the caller; or 0 if fd is not open.
+static struct file*
+fdfree(int fd)
+{
+  struct file *f;
+  struct fdtable *fdt = myproc()->fdt;
+
+  acquire(&fdt->lock);
+  f = fdt->ofile[fd];
+  fdt->ofile[fd] = 0;
+  release(&fdt->lock);
+  return f;
+}
+
 uint64
 sys_dup(void)
 {
@@ -59,9 +91,10 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -69,21 +102,23 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
   argaddr(1, &p);
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
   
   argaddr(1, &p);
@@ -91,7 +126,102 @@ sys_write(void)
   if(argfd(0, 0, &f) < 0)
     return -1;
 
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
+}
+
+// Fetch the iovec array of readv/writev from user space.
+// Returns the number of iovecs, or -1 if the array is bad.
+static int
+argiov(struct iovec *iov)
+{
+  uint64 uiov, tot;
+  int i, cnt;
+
+  argaddr(1, &uiov);
+  argint(2, &cnt);
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    tot += iov[i].iov_len;
+    if(iov[i].iov_len > MAXFILE*BSIZE || tot > MAXFILE*BSIZE)
+      return -1;
+  }
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt, r;
+
+  if((cnt = argiov(iov)) < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = filereadv(f, iov, cnt);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt, r;
+
+  if((cnt = argiov(iov)) < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = filewritev(f, iov, cnt);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off, r;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(off < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepread(f, p, n, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off, r;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(off < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = filepwrite(f, p, n, off);
+  fileclose(f);
+  return r;
 }
 
 uint64
@@ -100,9 +230,9 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  argint(0, &fd);
+  if(fd < 0 || fd >= NOFILE || (f = fdfree(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -112,11 +242,14 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
   argaddr(1, &st);
   if(argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -301,18 +434,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with open() mode omode and return a new
+// file for it, or 0.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -320,33 +448,31 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -367,6 +493,25 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -431,20 +576,26 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Free the strings fetchargv() fetched.
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the user array of argument strings at uargv into
+// argv, each string in a page of its own.
+// Returns 0, or -1 with nothing allocated.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG * sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +611,111 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
 
+  int ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// Apply file action a to fdt, a new process's table of
+// open files that nothing else uses yet. See spawn().
+int
+fdaction(struct fdtable *fdt, struct spawnact *a)
+{
+  struct file *f;
+  int fd = a->op == SPAWN_DUP2 ? a->newfd : a->fd;
+
+  if(a->fd < 0 || a->fd >= NOFILE || fd < 0 || fd >= NOFILE)
+    return -1;
+  switch(a->op){
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  case SPAWN_DUP2:
+    if(fdt->ofile[a->fd] == 0)
+      return -1;
+    f = filedup(fdt->ofile[a->fd]);
+    break;
+  case SPAWN_OPEN:
+    if((f = openfile(a->path, a->mode)) == 0)
+      return -1;
+    break;
+  default:
+    return -1;
+  }
+  if(fdt->ofile[fd])
+    fileclose(fdt->ofile[fd]);
+  fdt->ofile[fd] = f;
+  return 0;
+}
+
+// spawn(path, argv, act): start path in a new process,
+// after the file actions in act, which may be 0.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG], *kpath;
+  struct spawnact act[NSPAWNACT], a;
+  uint64 uargv, uact;
+  int i, n, ret = -1;
+
+  argaddr(1, &uargv);
+  argaddr(2, &uact);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  // copy in the actions, and the paths they open.
+  for(n = 0; uact != 0; n++){
+    if(copyin(myproc()->pagetable, (char*)&a, uact + n*sizeof(a), sizeof(a)) < 0)
+      goto out;
+    if(a.op == 0)
+      break;
+    if(n >= NSPAWNACT)
+      goto out;
+    if(a.op == SPAWN_OPEN){
+      if((kpath = kalloc()) == 0)
+        goto out;
+      if(fetchstr((uint64)a.path, kpath, MAXPATH) < 0){
+        kfree(kpath);
+        goto out;
+      }
+      a.path = kpath;
+    } else {
+      a.path = 0;
+    }
+    act[n] = a;
+  }
+
+  ret = spawn(path, argv, act, n);
+
+ out:
+  for(i = 0; i < n; i++)
+    if(act[i].path)
+      kfree(act[i].path);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -488,18 +732,82 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdfree(fd0);
+    fdfree(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  struct file *f;
+  uint64 addr;
+  int len, prot, flags, off;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(len <= 0 || off < 0)
+    return -1;
+  if(argfd(4, 0, &f) < 0)
+    return -1;
+  // addr is only a hint, and is ignored.
+  addr = mmap(f, len, prot, flags, off);
+  fileclose(f);
+  return addr;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Make a shared memory object of size bytes and return an fd
+// for it. Processes that share the fd (e.g. through fork) and
+// mmap() it with MAP_SHARED share its pages.
+uint64
+sys_memfd(void)
+{
+  int size, fd;
+  struct shm *sh;
+  struct file *f;
+
+  argint(0, &size);
+  if(size <= 0 || (sh = shmalloc(size)) == 0)
+    return -1;
+  if((f = filealloc()) == 0){
+    shmput(sh);
+    return -1;
+  }
+  f->type = FD_SHM;
+  f->shm = sh;
+  f->off = 0;
+  f->readable = 1;
+  f->writable = 1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
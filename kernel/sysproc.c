@@ -4,7 +4,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "futex.h"
+#include "meminfo.h"
 
 uint64
 sys_exit(void)
@@ -27,6 +30,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -36,16 +45,88 @@ sys_wait(void)
 }
 
 uint64
-sys_sbrk(void)
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  argint(0, &tid);
+  argaddr(1, &p);
+  return join(tid, p);
+}
+
+uint64
+sys_waitpid(void)
+{
+  int pid, options;
+  uint64 p;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  argint(2, &options);
+  return wait4(pid, p, options, 0);
+}
+
+uint64
+sys_wait4(void)
+{
+  int pid, options;
+  uint64 p, ru;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  argint(2, &options);
+  argaddr(3, &ru);
+  return wait4(pid, p, options, ru);
+}
+
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 ru;
+
+  argint(0, &who);
+  argaddr(1, &ru);
+  return getrusage(who, ru);
+}
+
+uint64
+sys_futex(void)
 {
   uint64 addr;
+  int op, val;
+
+  argaddr(0, &addr);
+  argint(1, &op);
+  argint(2, &val);
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
+
+uint64
+sys_sbrk(void)
+{
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -120,16 +201,69 @@ sys_set(void)
 }
 
 uint64
-sys_psinfo(void)
+sys_procsnap(void)
 {
-  struct proc_info *proc_user_buf;
-  struct cpu_info *cpu_user_buf;
-  struct proc_cpu_num *user_num_buf;
-  argaddr(0, (uint64*)&proc_user_buf);
-  argaddr(1, (uint64*)&cpu_user_buf);
-  argaddr(2, (uint64*)&user_num_buf);
+  uint64 addr;
+  int cursor, n;
 
+  argaddr(0, &addr);
+  argint(1, &cursor);
+  argint(2, &n);
+  return procsnap(addr, cursor, n);
+}
 
-  return psinfo(proc_user_buf, cpu_user_buf, user_num_buf);
-   
+uint64
+sys_cpustat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return cpustat(addr, n);
+}
+
+uint64
+sys_profctl(void)
+{
+  int on;
+
+  argint(0, &on);
+  return profctl(on);
+}
+
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return profread(addr, n);
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n, flags;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  argint(2, &flags);
+  return lockstat(addr, n, flags);
+}
+
+uint64
+sys_meminfo(void)
+{
+  struct meminfo mi;
+  uint64 addr;
+
+  argaddr(0, &addr);
+  kmeminfo(&mi);
+  if(copyout(myproc()->pagetable, addr, (char*)&mi, sizeof(mi)) < 0)
+    return -1;
+  return 0;
 }
\ No newline at end of file
@@ -3,8 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "mman.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -45,7 +47,13 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // this CPU is out of user space; see mmsync().
+  mycpu()->uepoch++;
+
   struct proc *p = myproc();
+
+  // the time since usertrapret() was spent in user space.
+  ruclock(p, &p->utime);
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -59,6 +67,7 @@ usertrap(void)
     // sepc points to the ecall instruction,
     // but we want to return to the next instruction.
     p->trapframe->epc += 4;
+    mycpu()->nsyscall++;
 
     // an interrupt will change sepc, scause, and sstatus,
     // so enable only now that we're done with those registers.
@@ -67,12 +76,21 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 13 && vmafault(r_stval(), PROT_READ) == 0){
+    // load page fault in an mmap()ed region; now mapped.
+  } else if(r_scause() == 15 && vmafault(r_stval(), PROT_WRITE) == 0){
+    // store page fault in an mmap()ed region; now mapped.
+  } else if(r_scause() == 12 && vmafault(r_stval(), PROT_EXEC) == 0){
+    // instruction page fault in an mmap()ed region; now mapped.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
     setkilled(p);
   }
 
+  if(which_dev == 2 || which_dev == 3)
+    profsample(p->trapframe->epc, p->trapframe->s0, 1);
+
   if(killed(p))
     exit(-1);
 
@@ -96,6 +114,10 @@ usertrapret(void)
   // we're back in user space, where usertrap() is correct.
   intr_off();
 
+  // the time since usertrap() or the switch to p was spent
+  // in the kernel.
+  ruclock(p, &p->stime);
+
   // send syscalls, interrupts, and exceptions to uservec in trampoline.S
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
   w_stvec(trampoline_uservec);
@@ -119,20 +141,28 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // from here until usertrap(), this CPU counts as being in
+  // user space with p's page table (see mmsync()).
+  mycpu()->uepoch++;
+  __sync_synchronize();
+
+  // tell trampoline.S the user page table to switch to, and
+  // the ASID that tags its TLB entries on this CPU.
+  uint64 satp = MAKE_SATP_ASID(p->pagetable, mmasid(p->mm));
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
+
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
-// on whatever the current kernel stack is.
+// on whatever the current kernel stack is. fp is the interrupted
+// code's frame pointer (s0), for the profiler.
 void 
-kerneltrap()
+kerneltrap(uint64 fp)
 {
   int which_dev = 0;
   uint64 sepc = r_sepc();
@@ -150,6 +180,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
+  if(which_dev == 2 || which_dev == 3)
+    profsample(sepc, fp, 0);
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
     yield();
@@ -165,6 +198,8 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  // before the wakeup, so that a sleeper sees the new tick.
+  kstatstick();
   wakeup(&ticks);
   release(&tickslock);
 }
@@ -172,6 +207,7 @@ clockintr()
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if a timer interrupt between ticks, while profiling,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -186,6 +222,9 @@ devintr()
     // irq indicates which device interrupted.
     int irq = plic_claim();
 
+    if(irq)
+      mycpu()->nintr++;
+
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
@@ -204,15 +243,26 @@ devintr()
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
+    struct cpu *c = mycpu();
+    uint64 now = r_time();
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // profctl() makes the timer interrupt more often, but the
+    // clock still ticks, and processes still yield, once
+    // every TICKCYCLES.
+    if(now + TICKCYCLES/2 < c->nexttick)
+      return 3;
+    if(c->nexttick + TICKCYCLES < now)
+      c->nexttick = now;   // the first tick, or a late one
+    c->nexttick += TICKCYCLES;
+
+    if(cpuid() == 0){
+      clockintr();
+    }
+
     return 2;
   } else {
     return 0;
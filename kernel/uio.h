@@ -0,0 +1,9 @@
+// Buffer descriptors for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+struct iovec {
+  void *iov_base;   // Start of buffer (user address)
+  uint64 iov_len;   // Length of buffer in bytes
+};
+
+#define IOV_MAX 16  // maximum iovecs per readv() or writev()
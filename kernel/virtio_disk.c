@@ -117,15 +117,17 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
 
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
+  // allocate and zero queue memory: two contiguous pages, laid
+  // out as for a legacy device, with the descriptors and then
+  // the available ring in the first, and the used ring in the
+  // second.
+  char *q = kalloc_pages(1);
+  if(q == 0)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
+  memset(q, 0, 2*PGSIZE);
+  disk.desc = (struct virtq_desc *) q;
+  disk.avail = (struct virtq_avail *) (q + NUM*sizeof(struct virtq_desc));
+  disk.used = (struct virtq_used *) (q + PGSIZE);
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
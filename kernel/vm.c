@@ -5,17 +5,28 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "mman.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// largest ASID the harts implement, or 0 if they have none.
+uint64 asidmax;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static int mapsuperpages(pagetable_t, uint64, uint64, uint64, int);
+
 // Make a direct-map page table for the kernel.
+// kvmmap() uses megapages wherever it can, so that
+// the TLB can cover all of RAM with a few dozen entries.
 pagetable_t
 kvmmake(void)
 {
@@ -43,9 +54,6 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
   return kpgtbl;
 }
 
@@ -64,6 +72,11 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // find out how many ASID bits this hart implements, by
+  // writing ones to the field and reading back those that stuck.
+  // the kernel itself runs with ASID 0.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
@@ -82,14 +95,29 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A PTE at level 2 or 1 with any of R, W or X set is a leaf
+// for a whole gigapage or megapage, and walk() returns it.
+// The kernel's direct map uses them, and so do large user
+// heaps (see uvmalloc()).
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the PTE for va at the given level,
+// or a superpage leaf above it.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(PTE_LEAF(*pte))
+      return pte;   // maybe made invalid by uvminval()
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
@@ -99,7 +127,35 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(level, va)];
+}
+
+// Return the leaf PTE that maps user address va, whether valid
+// or made invalid by uvminval(), or 0 if there is none, and set
+// *level to its level: 0 for a 4KB page, 1 for a megapage.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  pte_t *pte;
+
+  for(int l = 2; ; l--) {
+    pte = &pagetable[PX(l, va)];
+    if(l == 0 || PTE_LEAF(*pte)){
+      *level = l;
+      return *pte ? pte : 0;
+    }
+    if((*pte & PTE_V) == 0)
+      return 0;
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+}
+
+// The physical address of the page holding user address va,
+// which leaf PTE pte at the given level maps.
+static uint64
+leafpa(pte_t pte, int level, uint64 va)
+{
+  return PTE2PA(pte) + (PGROUNDDOWN(va) & (PXSIZE(level) - 1));
 }
 
 // Look up a virtual address, return the physical address,
@@ -109,20 +165,19 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return leafpa(*pte, level, va);
 }
 
 // add a mapping to the kernel page table.
@@ -131,7 +186,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mapsuperpages(kpgtbl, va, sz, pa, perm) != 0)
     panic("kvmmap");
 }
 
@@ -164,33 +219,178 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Like mappages(), but wherever va and pa are both aligned to
+// a gigapage or megapage and the range covers all of it, map it
+// with one leaf PTE at level 2 or 1. The rest of vm.c expects
+// user memory in 4KB pages, so only kvmmap() uses this.
+static int
+mapsuperpages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+  uint64 a, end;
+  pte_t *pte;
+  int level;
+
+  if(size == 0)
+    panic("mapsuperpages: size");
+
+  a = PGROUNDDOWN(va);
+  end = PGROUNDDOWN(va + size - 1) + PGSIZE;
+  while(a < end){
+    for(level = 2; level > 0; level--){
+      if(a % PXSIZE(level) == 0 && pa % PXSIZE(level) == 0 &&
+         end - a >= PXSIZE(level))
+        break;
+    }
+    if((pte = walklevel(pagetable, a, level, 1)) == 0)
+      return -1;
+    if(*pte & PTE_V)
+      panic("mapsuperpages: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    a += PXSIZE(level);
+    pa += PXSIZE(level);
+  }
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that are not mapped, such as pages of
+// the program that were never faulted in, are skipped; pages
+// that uvminval() made invalid are still removed. A megapage
+// must be removed whole (see uvmsplit()).
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, sz;
   pte_t *pte;
+  int level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
+  for(a = va; a < va + npages*PGSIZE; a += sz){
+    sz = PGSIZE;
+    if((pte = walkleaf(pagetable, a, &level)) == 0)
+      continue;
+    if(level == 0 && PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if(level > 0){
+      sz = PXSIZE(level);
+      if(a % sz != 0 || a + sz > va + npages*PGSIZE)
+        panic("uvmunmap: part of a megapage");
     }
+    if(do_free)
+      kfree_pages((void*)PTE2PA(*pte), PXORDER(level));
     *pte = 0;
   }
 }
 
+// Make npages of mappings starting from va invalid, but
+// leave the physical addresses in the PTEs for uvmunmap(),
+// so that the pages can be freed once no other thread
+// can still be using them (see mmsync()).
+void
+uvminval(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  uint64 a, sz;
+  pte_t *pte;
+  int level;
+
+  for(a = va; a < va + npages*PGSIZE; a += sz){
+    sz = PGSIZE;
+    if((pte = walkleaf(pagetable, a, &level)) == 0)
+      continue;
+    if(level > 0){
+      sz = PXSIZE(level);
+      if(a % sz != 0 || a + sz > va + npages*PGSIZE)
+        panic("uvminval: part of a megapage");
+    }
+    *pte &= ~PTE_V;
+  }
+}
+
+// Map a megapage at va, which must be megapage-aligned, to
+// physical address pa. Returns 0, or -1 if out of memory or if
+// there is already a level-0 page table for the range.
+static int
+mapmega(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walklevel(pagetable, va, 1, 1)) == 0 || *pte != 0)
+    return -1;
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
+// If va lies inside a megapage, but not at its start, map the
+// megapage with 4KB pages instead, so that the part below va
+// can stay when the rest is unmapped. The translations do not
+// change, so the TLB need not be flushed.
+// Returns 0, or -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  int level, i;
+
+  if((pte = walkleaf(pagetable, va, &level)) == 0 || level == 0)
+    return 0;
+  if(va % PXSIZE(level) == 0)
+    return 0;
+  if(level != 1)
+    panic("uvmsplit");
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Gather the 512 pages mapped at the megapage-aligned address
+// va into one megapage, if they are all present, writable, not
+// shared, and alike, and if there is a free megapage.
+// Returns 1 if it did; the caller must then flush the old
+// mappings (mmsync()) before returning to user space. The
+// copy would miss stores from other threads, so the caller
+// must be the only one.
+int
+uvmpromote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 perm;
+  char *mem;
+  int i;
+
+  pte = walklevel(pagetable, va, 1, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+    return 0;
+  pt = (pagetable_t)PTE2PA(*pte);
+  perm = pt[0] & (PTE_V|PTE_R|PTE_W|PTE_X|PTE_U);
+  if((perm & (PTE_V|PTE_W|PTE_U)) != (PTE_V|PTE_W|PTE_U))
+    return 0;
+  for(i = 0; i < 512; i++){
+    if((pt[i] & (PTE_V|PTE_R|PTE_W|PTE_X|PTE_U)) != perm)
+      return 0;
+    if(krefcnt((void*)PTE2PA(pt[i])) != 1)
+      return 0;
+  }
+  if((mem = kalloc_pages(PXORDER(1))) == 0)
+    return 0;
+  for(i = 0; i < 512; i++){
+    memmove(mem + i*PGSIZE, (char*)PTE2PA(pt[i]), PGSIZE);
+    kfree((void*)PTE2PA(pt[i]));
+  }
+  kfree(pt);
+  *pte = PA2PTE(mem) | perm;
+  return 1;
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t
@@ -222,17 +422,29 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Each aligned 2MB that the new memory covers is a megapage,
+// if one is free, so that one TLB entry maps all of it.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, sz;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
+  for(a = oldsz; a < newsz; a += sz){
+    sz = PGSIZE;
+    if(a % PXSIZE(1) == 0 && a + PXSIZE(1) <= newsz &&
+       (mem = kalloc_pages(PXORDER(1))) != 0){
+      memset(mem, 0, PXSIZE(1));
+      if(mapmega(pagetable, a, (uint64)mem, PTE_R|PTE_U|xperm) == 0){
+        sz = PXSIZE(1);
+        continue;
+      }
+      kfree_pages(mem, PXORDER(1));
+    }
     mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
@@ -296,27 +508,81 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
+// Copy the megapage at va, at physical address pa, into page
+// table new, as uvmcopy() would: into a megapage if there is a
+// free one, else into 4KB pages. Returns 0, or -1 if out of
+// memory, with none of it mapped in new.
+static int
+uvmcopymega(pagetable_t new, uint64 va, uint64 pa, uint flags)
+{
+  uint64 off;
+  char *mem;
+
+  if((flags & PTE_W) == 0){
+    if(mapmega(new, va, pa, flags) != 0)
+      return -1;
+    for(off = 0; off < PXSIZE(1); off += PGSIZE)
+      kref((void*)(pa + off));
+    return 0;
+  }
+  if((mem = kalloc_pages(PXORDER(1))) != 0){
+    memmove(mem, (char*)pa, PXSIZE(1));
+    if(mapmega(new, va, (uint64)mem, flags) == 0)
+      return 0;
+    kfree_pages(mem, PXORDER(1));
+  }
+  for(off = 0; off < PXSIZE(1); off += PGSIZE){
+    if((mem = kalloc()) == 0)
+      goto err;
+    memmove(mem, (char*)(pa + off), PGSIZE);
+    if(mappages(new, va + off, PGSIZE, (uint64)mem, flags) != 0){
+      kfree(mem);
+      goto err;
+    }
+  }
+  return 0;
+
+ err:
+  uvmunmap(new, va, off / PGSIZE, 1);
+  return -1;
+}
+
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except that read-only pages,
+// such as program text, are shared, and pages
+// not yet faulted in are left for the child
+// to fault in.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, n;
   uint flags;
   char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = 0; i < sz; i += n){
+    n = PGSIZE;
+    if((pte = walkleaf(old, i, &level)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if(level > 0){
+      n = PXSIZE(level);
+      if(uvmcopymega(new, i, pa, flags) != 0)
+        goto err;
+      continue;
+    }
+    if((flags & PTE_W) == 0){
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      kref((void*)pa);
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -345,6 +611,57 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Look up user page va0 for copyin/copyout, and return its
+// physical address, or 0 if the user may not access it.
+// If pagetable is the current process's and the page is in
+// an mmap()ed region, fault it in first.
+// A page fault takes mm->lock and inode locks, so it is refused
+// while holding a lock; system calls that copy with locks held
+// fault the pages in beforehand with uvmprefault().
+static uint64
+uvmaccess(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  int need, level;
+
+  if(va0 >= MAXVA)
+    return 0;
+  need = PTE_V | PTE_U | (write ? PTE_W : 0);
+  pte = walkleaf(pagetable, va0, &level);
+  if(pte == 0 || (*pte & need) != need){
+    if(p == 0 || p->pagetable != pagetable)
+      return 0;
+    if(p->nsleep > 0 || intr_get() == 0)
+      return 0;   // holding a sleep-lock or a spinlock
+    if(vmafault(va0, write ? PROT_WRITE : PROT_READ) < 0)
+      return 0;
+    if((pte = walkleaf(pagetable, va0, &level)) == 0)
+      return 0;
+  }
+  return leafpa(*pte, level, va0);
+}
+
+// Fault in the current process's user memory in [va, va+len),
+// for writing if write is set, so that copyin() and copyout()
+// can reach it later with locks held.
+// Returns 0, or -1 if some of it is not accessible.
+int
+uvmprefault(uint64 va, uint64 len, int write)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  uint64 a;
+
+  if(len == 0)
+    return 0;
+  if(va + len < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(uvmaccess(pagetable, a, write) == 0)
+      return -1;
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -355,7 +672,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -380,7 +697,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -407,7 +724,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaccess(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,4 @@
+// waitpid() options.
+// Both the kernel and user programs use this header file.
+
+#define WNOHANG  1   // return 0 at once if no child has exited
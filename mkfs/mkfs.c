@@ -41,6 +41,12 @@ void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void die(const char *);
+void rootdir(uint rootino);
+
+// Root directory entries, written out as a hashed
+// directory once every file has been added.
+struct dirent rootents[DXMAX*DPB];
+int nrootents;
 
 // convert to riscv byte order
 ushort
@@ -69,10 +75,9 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -101,9 +106,10 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d, block size %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, BSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -117,25 +123,13 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
+    // get rid of the directory, "user/" or "kernel/".
     char *shortname;
-    if(strncmp(argv[i], "user/", 5) == 0)
-      shortname = argv[i] + 5;
+    if((shortname = rindex(argv[i], '/')) != 0)
+      shortname++;
     else
       shortname = argv[i];
-    
-    assert(index(shortname, '/') == 0);
 
     if((fd = open(argv[i], 0)) < 0)
       die(argv[i]);
@@ -149,10 +143,12 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
+    if(nrootents >= sizeof(rootents)/sizeof(rootents[0]))
+      die("too many files");
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootents[nrootents++] = de;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +156,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  rootdir(rootino);
 
   balloc(freeblock);
 
@@ -227,6 +218,7 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  din.flags = xint(I_INLINE);
   winode(inum, &din);
   return inum;
 }
@@ -261,6 +253,24 @@ iappend(uint inum, void *xp, int n)
 
   rinode(inum, &din);
   off = xint(din.size);
+  if(xint(din.flags) & I_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, (char*)din.addrs + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // too big to stay inline: move the data out to a block.
+    bcopy(din.addrs, buf, off);
+    bzero(din.addrs, sizeof(din.addrs));
+    din.flags = xint(xint(din.flags) & ~I_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    if(off > 0)
+      iappend(inum, buf, off);
+    rinode(inum, &din);
+    off = xint(din.size);
+  }
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
@@ -293,6 +303,90 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Hash a name for the directory index.
+// Must agree with dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261U;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+direntcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Number of sorted root entries, starting at i, that go in
+// the next leaf. Leaves are filled to three quarters so the
+// kernel can add files without splitting right away, and a
+// run of equal hashes is never split across leaves.
+int
+leafsize(int i)
+{
+  int n;
+
+  for(n = 0; i + n < nrootents && n < DPB; n++)
+    if(n >= DPB*3/4 && dirhash(rootents[i+n].name) != dirhash(rootents[i+n-1].name))
+      break;
+  if(n == DPB && i + n < nrootents &&
+     dirhash(rootents[i+n].name) == dirhash(rootents[i+n-1].name))
+    die("too many equal hashes");
+  return n;
+}
+
+// Write the root directory as a hashed directory: block 0
+// holds "." and ".." and the index, followed by the leaves.
+void
+rootdir(uint rootino)
+{
+  char root[BSIZE], leaf[BSIZE];
+  struct dirent *de = (struct dirent*)root;
+  struct dxhead *h = (struct dxhead*)(de + 2);
+  struct dxentry *e = (struct dxentry*)(de + 3);
+  int i, n, nleaf;
+
+  qsort(rootents, nrootents, sizeof(rootents[0]), direntcmp);
+
+  bzero(root, sizeof(root));
+  de[0].inum = xshort(rootino);
+  strcpy(de[0].name, ".");
+  de[1].inum = xshort(rootino);
+  strcpy(de[1].name, "..");
+
+  nleaf = 0;
+  i = 0;
+  do {
+    if(nleaf >= DXMAX)
+      die("root directory index full");
+    e[nleaf].hash = xint(nleaf == 0 ? 0 : dirhash(rootents[i].name));
+    e[nleaf].block = xint(nleaf + 1);
+    nleaf++;
+    i += leafsize(i);
+  } while(i < nrootents);
+  h->magic = xshort(DXMAGIC);
+  h->nleaf = xint(nleaf);
+  iappend(rootino, root, BSIZE);
+
+  i = 0;
+  do {
+    n = leafsize(i);
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, &rootents[i], n * sizeof(struct dirent));
+    iappend(rootino, leaf, BSIZE);
+    i += n;
+  } while(i < nrootents);
+}
+
 void
 die(const char *s)
 {
@@ -1,11 +1,13 @@
 // Test that fork fails gracefully.
-// Tiny executable so that the limit can be filling the proc table.
+// There is no fixed limit on processes, so fork fails when
+// memory runs out; this is a tiny executable so that most of
+// the memory goes to the processes themselves.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-#define N  1000
+#define N  100000
 
 void
 print(const char *s)
@@ -0,0 +1,104 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+// prints how often each class of kernel lock (the locks given
+// the same name) was acquired and had to wait, how long waiters
+// spun or slept, and the longest any lock of the class was
+// held, sorted by the given count, most first. with -r, zeroes
+// the counts once read, so the next run shows what happened
+// in between.
+// lockstat [-r] [-s acquire|contend|wait|hold]
+
+#define NCLASS 64
+
+// ticks of the time CSR per microsecond; qemu's virt board runs it at 10 MHz.
+#define TICKS_PER_US 10
+
+static struct lockstat classes[NCLASS];
+static int order[NCLASS];
+
+static char *keys[] = {"acquire", "contend", "wait", "hold"};
+
+static uint64
+key(struct lockstat *l, int k)
+{
+    switch (k)
+    {
+    case 0:
+        return l->nacquire;
+    case 1:
+        return l->ncontend;
+    case 2:
+        return l->wait;
+    default:
+        return l->maxhold;
+    }
+}
+
+static void
+show(int n, int sleep, int k)
+{
+    int i, j, m = 0;
+
+    // insertion sort of the classes of one kind, most first.
+    for (i = 0; i < n; i++)
+    {
+        if (classes[i].sleep != sleep)
+            continue;
+        for (j = m++; j > 0 && key(&classes[order[j - 1]], k) < key(&classes[i], k); j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    if (sleep)
+        printf("\nsleep-locks\tacquire\tcontend\t%%\tus asleep\tus max held\n");
+    else
+        printf("spinlocks\tacquire\tcontend\t%%\tcycles spun\tcycles max held\n");
+    for (j = 0; j < m; j++)
+    {
+        struct lockstat *l = &classes[order[j]];
+        uint64 pct = l->nacquire ? l->ncontend * 1000 / l->nacquire : 0;
+        printf("%s\t%s%l\t%l\t%l.%l\t", l->name, strlen(l->name) < 8 ? "\t" : "",
+               l->nacquire, l->ncontend, pct / 10, pct % 10);
+        if (sleep)
+            printf("%l\t\t%l\n", l->wait / TICKS_PER_US, l->maxhold / TICKS_PER_US);
+        else
+            printf("%l\t\t%l\n", l->wait, l->maxhold);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int n, k = 2, flags = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+            flags |= LOCKSTAT_RESET;
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            i++;
+            for (k = 0; k < 4 && strcmp(argv[i], keys[k]) != 0; k++)
+                ;
+            if (k == 4)
+                goto usage;
+        }
+        else
+            goto usage;
+    }
+
+    if ((n = lockstat(classes, NCLASS, flags)) < 0)
+    {
+        fprintf(2, "lockstat: lockstat failed\n");
+        exit(1);
+    }
+    show(n, 0, k);
+    show(n, 1, k);
+    exit(0);
+
+usage:
+    fprintf(2, "usage: lockstat [-r] [-s acquire|contend|wait|hold]\n");
+    exit(1);
+}
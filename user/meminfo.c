@@ -0,0 +1,24 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/meminfo.h"
+#include "user/user.h"
+
+// print how much physical memory is free, and how
+// fragmented it is: the free blocks of each size.
+int main(int argc, char *argv[])
+{
+    struct meminfo mi;
+
+    if (meminfo(&mi) < 0)
+    {
+        fprintf(2, "meminfo: failed\n");
+        exit(1);
+    }
+    printf("%l pages, %l free (%l KB of %l KB)\n",
+           mi.npages, mi.nfree, mi.nfree * 4, mi.npages * 4);
+    printf("order\tblock\tfree blocks\n");
+    for (int k = 0; k <= MAXORDER; k++)
+        printf("%d\t%dKB\t%l\n", k, 4 << k, mi.nblocks[k]);
+    exit(0);
+}
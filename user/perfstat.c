@@ -0,0 +1,134 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+// runs a command and reports what it cost: the wall time, and
+// the CPU usage the kernel charged to it and to the children it
+// waited for. with -r n, runs it n times and reports the mean
+// and standard deviation of each count, for benchmarking.
+// perfstat [-r n] command [args ...]
+
+// ticks of the time CSR per microsecond; qemu's virt board runs it at 10 MHz.
+#define TICKS_PER_US 10
+
+#define MAXRUNS 100
+#define NSTAT 10
+
+static char *names[NSTAT] = {
+    "us wall",
+    "us user",
+    "us sys",
+    "us runnable",
+    "page faults",
+    "voluntary switches",
+    "involuntary switches",
+    "system calls",
+    "cycles",
+    "instructions",
+};
+
+static uint64 stats[MAXRUNS][NSTAT];
+
+static inline uint64
+rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+// integer square root, by Newton's method.
+static uint64
+isqrt(uint64 x)
+{
+    uint64 r = x, y = (x + 1) / 2;
+
+    while (y < r)
+    {
+        r = y;
+        y = (r + x / r) / 2;
+    }
+    return r;
+}
+
+// run the command once, recording its counts in st;
+// return its exit status.
+static int
+run(char **argv, uint64 *st)
+{
+    struct rusage ru;
+    int pid, xstatus;
+    uint64 t0;
+
+    t0 = rdtime();
+    if ((pid = spawn(argv[0], argv, 0)) < 0)
+    {
+        fprintf(2, "perfstat: exec %s failed\n", argv[0]);
+        exit(1);
+    }
+    if (wait4(pid, &xstatus, 0, &ru) != pid)
+    {
+        fprintf(2, "perfstat: wait failed\n");
+        exit(1);
+    }
+    st[0] = (rdtime() - t0) / TICKS_PER_US;
+    st[1] = ru.utime / TICKS_PER_US;
+    st[2] = ru.stime / TICKS_PER_US;
+    st[3] = ru.wtime / TICKS_PER_US;
+    st[4] = ru.nfault;
+    st[5] = ru.nvcsw;
+    st[6] = ru.nivcsw;
+    st[7] = ru.nsyscall;
+    st[8] = ru.cycles;
+    st[9] = ru.instret;
+    return xstatus;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1, i = 1, xstatus = 0;
+
+    if (argc > 2 && strcmp(argv[1], "-r") == 0)
+    {
+        n = atoi(argv[2]);
+        i = 3;
+    }
+    if (i >= argc || n < 1 || n > MAXRUNS)
+    {
+        fprintf(2, "usage: perfstat [-r runs, 1-%d] command [args ...]\n", MAXRUNS);
+        exit(1);
+    }
+
+    for (int r = 0; r < n; r++)
+    {
+        int x = run(argv + i, stats[r]);
+        if (x != 0)
+        {
+            fprintf(2, "perfstat: %s exited with status %d\n", argv[i], x);
+            xstatus = x;
+        }
+    }
+
+    printf("perfstat: %s, %d run%s\n", argv[i], n, n > 1 ? "s" : "");
+    for (int s = 0; s < NSTAT; s++)
+    {
+        uint64 sum = 0, var = 0, mean;
+
+        for (int r = 0; r < n; r++)
+            sum += stats[r][s];
+        mean = sum / n;
+        if (n == 1)
+        {
+            printf("%l %s\n", mean, names[s]);
+            continue;
+        }
+        for (int r = 0; r < n; r++)
+        {
+            uint64 d = stats[r][s] > mean ? stats[r][s] - mean : mean - stats[r][s];
+            var += d * d / n;
+        }
+        printf("%l %s (+- %l)\n", mean, names[s], isqrt(var));
+    }
+    exit(xstatus);
+}
@@ -1,14 +1,41 @@
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "user/thread.h"
+
+// spin forever, counting in x.
+static void
+spin(void *x)
+{
+    while (1)
+    {
+        (*(volatile int *)x)++;
+    }
+}
 
 // this is a program to run in the background, a tester program for pstate sys_call
+// pi n keeps n harts busy, with n threads.
 int main(int argc, char *argv[])
 {
-    int x = 0;
-    while (1)
+    int x[NCPU];
+    int n = 1;
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (n < 1 || n > NCPU)
+    {
+        fprintf(2, "usage: pi [nthreads]\n");
+        exit(1);
+    }
+    for (int i = 1; i < n; i++)
     {
-        x++;
-    }  
+        if (thread_create(spin, &x[i]) < 0)
+        {
+            fprintf(2, "pi: thread_create failed\n");
+            exit(1);
+        }
+    }
+    spin(&x[0]);
     exit(0);
-}
\ No newline at end of file
+}
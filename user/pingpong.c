@@ -0,0 +1,73 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// context switch latency benchmark: two processes pass a byte
+// back and forth through a pair of pipes. each round trip is two
+// sleeps and two wakeups, and on a single hart two context switches.
+// pingpong [rounds]
+
+// ticks of the time CSR per microsecond; qemu's virt board runs it at 10 MHz.
+#define TICKS_PER_US 10
+
+static inline uint64
+rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 10000;
+    int ping[2], pong[2];
+    char c = 0;
+    uint64 t0, t1;
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (n < 1)
+    {
+        fprintf(2, "usage: pingpong [rounds]\n");
+        exit(1);
+    }
+    if (pipe(ping) < 0 || pipe(pong) < 0)
+    {
+        fprintf(2, "pingpong: pipe failed\n");
+        exit(1);
+    }
+
+    int pid = fork();
+    if (pid < 0)
+    {
+        fprintf(2, "pingpong: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+                exit(1);
+        }
+        exit(0);
+    }
+
+    t0 = rdtime();
+    for (int i = 0; i < n; i++)
+    {
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+        {
+            fprintf(2, "pingpong: lost the child\n");
+            exit(1);
+        }
+    }
+    t1 = rdtime();
+    wait(0);
+
+    uint64 ns = (t1 - t0) * (1000 / TICKS_PER_US) / n;
+    printf("pingpong: %d round trips, %l ns each, %l ns per switch\n",
+           n, ns, ns / 2);
+    exit(0);
+}
@@ -0,0 +1,391 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/wait.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+// runs a command with the kernel's sampling profiler on, and
+// reports the functions the CPUs were in: the share of samples
+// in each (self) and the share with it anywhere on the stack
+// (total). with -f, also writes each stack in the folded form
+// flamegraph.pl reads, "process;outer;...;inner count", kernel
+// frames marked _[k]. addresses are named from /kernel.sym and
+// each program's /name.sym. every process is sampled, not only
+// the command; "scheduler" samples are of idle CPUs.
+// prof [-f folded-file] command [args ...]
+
+#define MAXSTACKS 4096    // distinct stacks; a hash table, kept under 3/4 full
+#define MAXFUNCS 1024
+#define MAXTABS 32        // programs with symbols loaded
+#define BATCH 64          // samples per profread()
+#define NSHOW 30
+
+struct stack {
+    int count;
+    int npc;
+    int nkernel;
+    uint64 pc[NPROFPC];
+    char name[16];
+};
+
+struct sym {
+    uint64 addr;
+    char *name;
+};
+
+struct symtab {
+    char name[16];        // program, or "kernel"
+    int n;
+    struct sym *sym;      // in address order
+    struct sym unknown;   // for addresses before the first symbol
+};
+
+struct func {
+    struct symtab *tab;
+    struct sym *sym;
+    int self;
+    int total;
+    int last;             // stack last counted in total, plus one
+};
+
+static struct stack stacks[MAXSTACKS];
+static int nstacks, nsamples, lost;
+static struct symtab tabs[MAXTABS];
+static int ntabs;
+static struct func funcs[MAXFUNCS];
+static int order[MAXFUNCS];       // funcs[] indexes, most self samples first
+static int nfuncs;
+static struct profsample batch[BATCH];
+
+static uint
+hash(struct profsample *s)
+{
+    uint h = s->npc * 31 + s->nkernel;
+
+    for (int i = 0; i < s->npc; i++)
+        h = h * 31 + (uint)s->pc[i] + (uint)(s->pc[i] >> 32);
+    for (char *c = s->name; *c; c++)
+        h = h * 31 + *c;
+    return h;
+}
+
+static void
+add(struct profsample *s)
+{
+    struct stack *st;
+    uint h = hash(s) % MAXSTACKS;
+
+    nsamples++;
+    for (;; h = (h + 1) % MAXSTACKS)
+    {
+        st = &stacks[h];
+        if (st->count == 0)
+            break;
+        if (st->npc == s->npc && st->nkernel == s->nkernel && strcmp(st->name, s->name) == 0 &&
+            memcmp(st->pc, s->pc, s->npc * sizeof(s->pc[0])) == 0)
+        {
+            st->count++;
+            return;
+        }
+    }
+    if (nstacks >= MAXSTACKS / 4 * 3)
+    {
+        lost++;
+        return;
+    }
+    nstacks++;
+    st->count = 1;
+    st->npc = s->npc;
+    st->nkernel = s->nkernel;
+    memmove(st->pc, s->pc, s->npc * sizeof(s->pc[0]));
+    strcpy(st->name, s->name);
+}
+
+// move the samples waiting in the kernel into stacks[].
+static void
+drain(void)
+{
+    int n;
+
+    while ((n = profread(batch, BATCH)) > 0)
+        for (int i = 0; i < n; i++)
+            add(&batch[i]);
+    if (n < 0)
+    {
+        fprintf(2, "prof: profread failed\n");
+        exit(1);
+    }
+}
+
+static uint64
+hex(char **sp)
+{
+    uint64 x = 0;
+    char *s = *sp;
+
+    for (;; s++)
+    {
+        if (*s >= '0' && *s <= '9')
+            x = x * 16 + *s - '0';
+        else if (*s >= 'a' && *s <= 'f')
+            x = x * 16 + *s - 'a' + 10;
+        else
+            break;
+    }
+    *sp = s;
+    return x;
+}
+
+// a symbol names code, not a source file or a section.
+static int
+iscode(char *name)
+{
+    int n = strlen(name);
+
+    if (n == 0 || name[0] == '.' || name[0] == '$')
+        return 0;
+    return !(n > 2 && name[n - 2] == '.' && (name[n - 1] == 'c' || name[n - 1] == 'S'));
+}
+
+// read the symbols of a program, or of the kernel, from the
+// "address name" lines the Makefile writes to /name.sym.
+static void
+load(struct symtab *t)
+{
+    char path[32], *buf, *s, *e;
+    struct stat st;
+    int fd, n;
+
+    strcpy(path, "/");
+    strcpy(path + 1, t->name);
+    strcpy(path + strlen(path), ".sym");
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+    if (fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0)
+    {
+        close(fd);
+        return;
+    }
+    n = read(fd, buf, st.size);
+    close(fd);
+    buf[n > 0 ? n : 0] = '\0';
+
+    n = 0;
+    for (s = buf; *s; s++)
+        if (*s == '\n')
+            n++;
+    if ((t->sym = malloc((n + 1) * sizeof(struct sym))) == 0)
+        return;
+    for (s = buf; *s; s = e)
+    {
+        uint64 addr = hex(&s);
+        if ((e = strchr(s, '\n')) != 0)
+            *e++ = '\0';
+        else
+            e = s + strlen(s);
+        if (*s++ != ' ' || !iscode(s))
+            continue;
+        t->sym[t->n].addr = addr;
+        t->sym[t->n].name = s;
+        t->n++;
+    }
+
+    // shell sort, by address.
+    for (int gap = t->n / 2; gap > 0; gap /= 2)
+        for (int i = gap; i < t->n; i++)
+            for (int j = i - gap; j >= 0 && t->sym[j].addr > t->sym[j + gap].addr; j -= gap)
+            {
+                struct sym x = t->sym[j];
+                t->sym[j] = t->sym[j + gap];
+                t->sym[j + gap] = x;
+            }
+}
+
+static struct symtab *
+symtab(char *name)
+{
+    struct symtab *t;
+
+    for (t = tabs; t < &tabs[ntabs]; t++)
+        if (strcmp(t->name, name) == 0)
+            return t;
+    if (ntabs == MAXTABS)
+        return &tabs[MAXTABS - 1];
+    t = &tabs[ntabs++];
+    strcpy(t->name, name);
+    t->unknown.name = "?";
+    load(t);
+    return t;
+}
+
+// the last symbol at or below pc.
+static struct sym *
+lookup(struct symtab *t, uint64 pc)
+{
+    int lo = 0, hi = t->n;
+
+    if (t->n == 0 || pc < t->sym[0].addr)
+        return &t->unknown;
+    while (hi - lo > 1)
+    {
+        int mid = (lo + hi) / 2;
+        if (t->sym[mid].addr <= pc)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &t->sym[lo];
+}
+
+// the function of frame i of st. every frame but the first of
+// the kernel's and of the user's is a return address, just
+// past the call.
+static struct func *
+frame(struct stack *st, int i)
+{
+    struct symtab *t = i < st->nkernel ? symtab("kernel") : symtab(st->name);
+    uint64 pc = st->pc[i];
+    struct sym *s;
+    struct func *f;
+
+    if (i != 0 && i != st->nkernel)
+        pc--;
+    s = lookup(t, pc);
+    for (f = funcs; f < &funcs[nfuncs]; f++)
+        if (f->sym == s)
+            return f;
+    if (nfuncs == MAXFUNCS)
+        return 0;
+    f = &funcs[nfuncs++];
+    f->tab = t;
+    f->sym = s;
+    return f;
+}
+
+// percent of part in whole, to a tenth.
+static void
+percent(int part, int whole)
+{
+    int t = whole ? part * 1000 / whole : 0;
+
+    printf("%d.%d%%", t / 10, t % 10);
+}
+
+static void
+report(int dropped)
+{
+    int i, j, k;
+
+    for (i = 0; i < MAXSTACKS; i++)
+    {
+        struct stack *st = &stacks[i];
+        if (st->count == 0)
+            continue;
+        for (j = 0; j < st->npc; j++)
+        {
+            struct func *f = frame(st, j);
+            if (f == 0)
+                continue;
+            if (j == 0)
+                f->self += st->count;
+            if (f->last != i + 1)
+                f->total += st->count;   // once per stack, even if recursive
+            f->last = i + 1;
+        }
+    }
+    // insertion sort, most self samples first.
+    for (i = 0; i < nfuncs; i++)
+    {
+        for (k = i; k > 0 && funcs[order[k - 1]].self < funcs[i].self; k--)
+            order[k] = order[k - 1];
+        order[k] = i;
+    }
+
+    printf("prof: %d samples, %d dropped, %d in stacks not kept\n", nsamples, dropped, lost);
+    printf("self\ttotal\tfunction\n");
+    for (k = 0; k < nfuncs && k < NSHOW; k++)
+    {
+        struct func *f = &funcs[order[k]];
+        if (f->self == 0)
+            break;
+        percent(f->self, nsamples);
+        printf("\t");
+        percent(f->total, nsamples);
+        printf("\t%s %s\n", f->tab->name, f->sym->name);
+    }
+}
+
+// write the stacks as flamegraph.pl wants them.
+static void
+folded(char *path)
+{
+    int fd;
+
+    if ((fd = open(path, O_CREATE | O_TRUNC | O_WRONLY)) < 0)
+    {
+        fprintf(2, "prof: cannot create %s\n", path);
+        exit(1);
+    }
+    for (int i = 0; i < MAXSTACKS; i++)
+    {
+        struct stack *st = &stacks[i];
+        if (st->count == 0)
+            continue;
+        fprintf(fd, "%s", st->name);
+        for (int j = st->npc - 1; j >= 0; j--)
+        {
+            struct func *f = frame(st, j);
+            fprintf(fd, ";%s%s", f ? f->sym->name : "?", j < st->nkernel ? "_[k]" : "");
+        }
+        fprintf(fd, " %d\n", st->count);
+    }
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    char *path = 0;
+    int i = 1, pid, xstatus, dropped, r;
+
+    if (argc > 2 && strcmp(argv[1], "-f") == 0)
+    {
+        path = argv[2];
+        i = 3;
+    }
+    if (i >= argc)
+    {
+        fprintf(2, "usage: prof [-f folded-file] command [args ...]\n");
+        exit(1);
+    }
+
+    if (profctl(1) < 0)
+    {
+        fprintf(2, "prof: profctl failed\n");
+        exit(1);
+    }
+    if ((pid = spawn(argv[i], argv + i, 0)) < 0)
+    {
+        profctl(0);
+        fprintf(2, "prof: exec %s failed\n", argv[i]);
+        exit(1);
+    }
+    // each CPU's ring holds a quarter second of samples.
+    while ((r = wait4(pid, &xstatus, WNOHANG, 0)) == 0)
+    {
+        drain();
+        sleep(1);
+    }
+    dropped = profctl(0);
+    if (r != pid)
+    {
+        fprintf(2, "prof: wait failed\n");
+        exit(1);
+    }
+    drain();
+
+    report(dropped);
+    if (path)
+        folded(path);
+    exit(xstatus);
+}
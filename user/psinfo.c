@@ -1,32 +1,58 @@
 #include "kernel/types.h"
-#include "kernel/param.h"
 #include "kernel/stat.h"
+#include "kernel/procsnap.h"
 #include "user/user.h"
 
+// lists the processes, a page of procsnap() records at a time:
+// the CPU each is running on, the CPU time it has used, and
+// the size of its memory.
+
+#define PAGE 16
+#define TICKS_PER_MS 10000  // of the time CSR; qemu's virt board runs it at 10 MHz
+
+static char *states[] = {
+    [PS_USED] "new",
+    [PS_SLEEPING] "sleeping",
+    [PS_RUNNABLE] "runnable",
+    [PS_RUNNING] "running",
+    [PS_ZOMBIE] "zombie",
+};
 
-// this user program invokes system call pstate
 int main(int argc, char *argv[])
 {
-    struct proc_info proc_user_buf[NPROC];
-    struct cpu_info cpu_user_buf[NCPU];
-    struct proc_cpu_num proc_cpu_num[2];
-    //int num_proc;
-    psinfo(proc_user_buf, cpu_user_buf, proc_cpu_num);
+    struct procsnap buf[PAGE];
+    int n, total = 0, cursor = 0;
 
-    //Print the process information
-    printf("pid\tname\tstate\t\tparent\n");
-    printf("___________________________________________\n");
-    for (int i = 0; i < proc_cpu_num[0].num; i++) {
-        printf("%d\t%s\t%s\t%s\n", proc_user_buf[i].pid, proc_user_buf[i].name, proc_user_buf[i].state, proc_user_buf[i].pName);
-        printf("___________________________________________\n");
+    printf("pid\tppid\tname\tstate\t\tprio\tcpu\tms\tkb\n");
+    printf("___________________________________________________________\n");
+    // pages of the process list may come from different
+    // moments, but each record is consistent.
+    while ((n = procsnap(buf, cursor, PAGE)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            struct procsnap *r = &buf[i];
+            if (r->version != PROCSNAP_VERSION)
+            {
+                fprintf(2, "psinfo: unknown record version %d\n", r->version);
+                exit(1);
+            }
+            printf("%d\t%d\t%s\t%s\t%s%d\t", r->pid, r->ppid, r->name, states[r->state],
+                   r->state == PS_SLEEPING || r->state == PS_RUNNABLE ? "" : "\t", r->priority);
+            if (r->cpu >= 0)
+                printf("%d", r->cpu);
+            else
+                printf("-");
+            printf("\t%l\t%l\n", (r->utime + r->stime) / TICKS_PER_MS, r->memsz / 1024);
+        }
+        total += n;
+        cursor = buf[n - 1].pid;
     }
-
-
-    printf("Total processes: %d\n", proc_cpu_num[0].num);
-
-    for (int i = 0; i < proc_cpu_num[1].num; i++) {
-        printf("cpu %d:\t%s\n", cpu_user_buf[i].cpu_num, cpu_user_buf[i].name);
+    if (n < 0)
+    {
+        fprintf(2, "psinfo: procsnap failed\n");
+        exit(1);
     }
-
+    printf("Total processes: %d\n", total);
     exit(0);
-}
\ No newline at end of file
+}
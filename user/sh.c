@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -53,6 +54,9 @@ int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
+void startcmd(struct cmd*, int*, int);
+void freecmd(struct cmd*);
+struct cmd *parsed;  // the command a vfork()ed child is running
 
 // Execute cmd.  Never returns.
 void
@@ -92,8 +96,7 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
+    startcmd(lcmd->left, 0, 0);
     wait(0);
     runcmd(lcmd->right);
     break;
@@ -102,20 +105,8 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
+    startcmd(pcmd->left, p, 1);
+    startcmd(pcmd->right, p, 0);
     close(p[0]);
     close(p[1]);
     wait(0);
@@ -124,13 +115,76 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
+    startcmd(bcmd->cmd, 0, 0);
     break;
   }
   exit(0);
 }
 
+// If cmd is a program with nothing but redirections, add
+// the redirections to the spawn() file actions act[*n..],
+// end them, and return the program; otherwise return 0.
+struct execcmd*
+simplecmd(struct cmd *cmd, struct spawnact *act, int *n)
+{
+  struct redircmd *rcmd;
+
+  // the outermost redirection is the last one typed; runcmd()
+  // applies it first, and so do these actions.
+  while(cmd && cmd->type == REDIR){
+    if(*n >= NSPAWNACT)
+      return 0;
+    rcmd = (struct redircmd*)cmd;
+    act[*n].op = SPAWN_OPEN;
+    act[*n].fd = rcmd->fd;
+    act[*n].mode = rcmd->mode;
+    act[*n].path = rcmd->file;
+    (*n)++;
+    cmd = rcmd->cmd;
+  }
+  if(cmd == 0 || cmd->type != EXEC || ((struct execcmd*)cmd)->argv[0] == 0)
+    return 0;
+  act[*n].op = 0;
+  return (struct execcmd*)cmd;
+}
+
+// Start cmd in a new process, with its fd connected to
+// pipe p unless p is 0. A simple command's program is
+// spawn()ed straight away; anything else gets a forked
+// shell to run it.
+void
+startcmd(struct cmd *cmd, int *p, int fd)
+{
+  struct spawnact act[NSPAWNACT+1];
+  struct execcmd *ecmd;
+  int n = 0;
+
+  if(p){
+    act[0].op = SPAWN_DUP2;
+    act[0].fd = p[fd];
+    act[0].newfd = fd;
+    act[1].op = SPAWN_CLOSE;
+    act[1].fd = p[0];
+    act[2].op = SPAWN_CLOSE;
+    act[2].fd = p[1];
+    n = 3;
+  }
+  if((ecmd = simplecmd(cmd, act, &n)) != 0){
+    if(spawn(ecmd->argv[0], ecmd->argv, act) < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    return;
+  }
+  if(fork1() == 0){
+    if(p){
+      close(fd);
+      dup(p[fd]);
+      close(p[0]);
+      close(p[1]);
+    }
+    runcmd(cmd);
+  }
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +200,7 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, pid;
   int history_fd;
 
   // open sh_history
@@ -173,10 +227,16 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0){
-      runcmd(parsecmd(buf));
-    }
+    // the child borrows the shell's memory, instead of a copy,
+    // until it execs the command or exits; then the shell can
+    // free the command the child parsed.
+    parsed = 0;
+    if((pid = vfork()) < 0)
+      panic("vfork");
+    if(pid == 0)
+      runcmd(parsed = parsecmd(buf));
     wait(0);
+    freecmd(parsed);
   }
   close(history_fd);
   exit(0);
@@ -502,3 +562,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,189 @@
+#include "kernel/types.h"
+#include "kernel/futex.h"
+#include "user/user.h"
+#include "user/thread.h"
+
+// Threads.
+// Each thread runs on a stack from sbrk(), which
+// thread_join() keeps for the next thread_create().
+
+#define NTHREAD 64
+#define TSTACK  (4*4096)
+
+// Where a new thread starts; at the top of its stack.
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;          // 0 if the stack is free
+  char *stack;
+} threads[NTHREAD];
+
+static struct mutex tlock;
+
+static void
+thread_start(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Start a thread that runs fn(arg) and then exits.
+// Returns its id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *t;
+  char *stack;
+  int i, tid;
+
+  mutex_lock(&tlock);
+  for(i = 0; i < NTHREAD; i++)
+    if(threads[i].tid == 0)
+      break;
+  if(i == NTHREAD){
+    mutex_unlock(&tlock);
+    return -1;
+  }
+  if(threads[i].stack == 0){
+    if((stack = sbrk(TSTACK)) == (char*)-1){
+      mutex_unlock(&tlock);
+      return -1;
+    }
+    threads[i].stack = stack;
+  }
+  threads[i].tid = -1;
+  mutex_unlock(&tlock);
+
+  t = (struct tstart*)(threads[i].stack + TSTACK) - 1;
+  t->fn = fn;
+  t->arg = arg;
+  // the stack pointer must be 16-byte aligned.
+  tid = clone(thread_start, t, (void*)((uint64)t & ~15L));
+
+  mutex_lock(&tlock);
+  threads[i].tid = tid < 0 ? 0 : tid;
+  mutex_unlock(&tlock);
+  return tid;
+}
+
+// Wait for thread tid, made by this thread, to exit.
+// Returns 0, or -1 if there is no such thread.
+int
+thread_join(int tid)
+{
+  int i;
+
+  if(tid <= 0 || join(tid, 0) != tid)
+    return -1;
+  mutex_lock(&tlock);
+  for(i = 0; i < NTHREAD; i++)
+    if(threads[i].tid == tid)
+      threads[i].tid = 0;
+  mutex_unlock(&tlock);
+  return 0;
+}
+
+// Mutexes, after Drepper, "Futexes Are Tricky": the
+// uncontended cases need no system call, and unlock
+// calls futex() only if some thread may be sleeping.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+// Condition variables.
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Unlock m and wait for a signal, then lock m again.
+// May return without a signal, so callers wait in a
+// loop that checks their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futex(&c->seq, FUTEX_WAKE, NTHREAD);
+}
+
+// Barriers.
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cv);
+  b->n = n;
+  b->count = 0;
+  b->round = 0;
+}
+
+// Wait until n threads have called barrier_wait().
+void
+barrier_wait(struct barrier *b)
+{
+  int round;
+
+  mutex_lock(&b->lock);
+  round = b->round;
+  if(++b->count == b->n){
+    b->count = 0;
+    b->round++;
+    cond_broadcast(&b->cv);
+  } else {
+    while(round == b->round)
+      cond_wait(&b->cv, &b->lock);
+  }
+  mutex_unlock(&b->lock);
+}
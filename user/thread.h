@@ -0,0 +1,42 @@
+// Threads and synchronization for user programs,
+// built on the clone(), join() and futex() system calls.
+// The threads of a process share its memory and open
+// files. malloc() is not safe to call from more than
+// one thread at a time.
+
+// A mutex. 0: unlocked, 1: locked, 2: locked, and other
+// threads may be waiting in futex().
+struct mutex {
+  int state;
+};
+
+// A condition variable. seq changes at each signal, so that
+// a waiter that unlocked the mutex just before the signal
+// does not go to sleep.
+struct cond {
+  int seq;
+};
+
+// Makes n threads wait for each other.
+struct barrier {
+  struct mutex lock;
+  struct cond cv;
+  int n;        // threads that must arrive
+  int count;    // threads that have arrived in this round
+  int round;
+};
+
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
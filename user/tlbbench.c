@@ -0,0 +1,122 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/futex.h"
+#include "user/user.h"
+#include "user/thread.h"
+
+// TLB reach benchmark: reads one word from each page of a large
+// heap, in a scattered order, so that nearly every read needs
+// a different TLB entry. The heap is grown once with 4KB pages
+// and once with megapages, each in a child process.
+// tlbbench [megabytes]
+
+#define MEGA (2*1024*1024)
+#define ROUNDS 20
+
+// ticks of the time CSR per microsecond; qemu's virt board runs it at 10 MHz.
+#define TICKS_PER_US 10
+
+static inline uint64
+rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+// a second thread alive while the heap grows stops the
+// kernel from gathering it into megapages.
+static int hold = 1;
+
+static void
+holder(void *arg)
+{
+    while (hold)
+        futex(&hold, FUTEX_WAIT, 1);
+}
+
+// grow the heap by size bytes, aligned to a megapage;
+// in 64KB steps, with another thread, for 4KB pages.
+static char *
+grow(int size, int small)
+{
+    int tid = 0;
+    char *a;
+
+    if (small && (tid = thread_create(holder, 0)) < 0)
+        return 0;
+    uint64 top = (uint64)sbrk(0);
+    if (sbrk((MEGA - top % MEGA) % MEGA) == (char *)-1)
+        return 0;
+    a = sbrk(0);
+    for (int n = 0; n < size; n += (small ? 64 * 1024 : size))
+    {
+        if (sbrk(small ? 64 * 1024 : size) == (char *)-1)
+            return 0;
+    }
+    if (small)
+    {
+        hold = 0;
+        futex(&hold, FUTEX_WAKE, 1);
+        thread_join(tid);
+    }
+    return a;
+}
+
+static void
+run(int size, int small)
+{
+    int npages = size / 4096;
+    volatile char *a;
+    uint64 sum = 0, t0, t1;
+
+    if ((a = grow(size, small)) == 0)
+    {
+        fprintf(2, "tlbbench: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < npages; i++)
+        a[i * 4096] = i;
+
+    t0 = rdtime();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        // 4099 is prime, so this visits every page in a scattered order.
+        for (int i = 0, pg = 0; i < npages; i++, pg = (pg + 4099) % npages)
+            sum += a[pg * 4096];
+    }
+    t1 = rdtime();
+
+    uint64 ns = (t1 - t0) * (1000 / TICKS_PER_US) / ((uint64)ROUNDS * npages);
+    printf("tlbbench: %s pages: %l ns per read (%d)\n",
+           small ? "4KB" : "2MB", ns, (int)(sum & 1));
+}
+
+int main(int argc, char *argv[])
+{
+    int mb = 16;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    if (mb < 2 || mb % 2 != 0 || mb > 64)
+    {
+        fprintf(2, "usage: tlbbench [megabytes, even, 2-64]\n");
+        exit(1);
+    }
+    for (int small = 1; small >= 0; small--)
+    {
+        int pid = fork();
+        if (pid < 0)
+        {
+            fprintf(2, "tlbbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            run(mb * 1024 * 1024, small);
+            exit(0);
+        }
+        wait(0);
+    }
+    exit(0);
+}
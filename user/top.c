@@ -0,0 +1,153 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/procsnap.h"
+#include "kernel/cpustat.h"
+#include "user/user.h"
+
+// shows, every interval, how busy each CPU was and the processes
+// that used the most CPU time, from the differences between two
+// samples of procsnap() and cpustat(). runs until killed, or for
+// the given number of rounds.
+// top [interval in ticks] [rounds]
+
+#define MAXPROCS 256
+#define PAGE 32
+#define NSHOW 16
+
+// ticks of the time CSR per millisecond; qemu's virt board runs it at 10 MHz.
+#define TICKS_PER_MS 10000
+
+struct sample {
+    uint64 time;                 // time CSR when taken
+    int nproc;
+    struct procsnap proc[MAXPROCS];   // in pid order
+    int ncpu;
+    struct cpustat cpu[NCPU];
+};
+
+static struct sample samples[2];
+static uint64 used[MAXPROCS];    // CPU time in the interval, by new sample index
+static int order[MAXPROCS];      // new sample indexes, most used first
+
+static char *states[] = {
+    [PS_USED] "new",
+    [PS_SLEEPING] "sleep",
+    [PS_RUNNABLE] "runble",
+    [PS_RUNNING] "run",
+    [PS_ZOMBIE] "zombie",
+};
+
+static inline uint64
+rdtime(void)
+{
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+static void
+take(struct sample *s)
+{
+    int n;
+
+    s->time = rdtime();
+    s->nproc = 0;
+    while (s->nproc < MAXPROCS)
+    {
+        int cursor = s->nproc > 0 ? s->proc[s->nproc - 1].pid : 0;
+        int want = MAXPROCS - s->nproc < PAGE ? MAXPROCS - s->nproc : PAGE;
+        if ((n = procsnap(&s->proc[s->nproc], cursor, want)) <= 0)
+            break;
+        s->nproc += n;
+    }
+    if ((s->ncpu = cpustat(s->cpu, NCPU)) < 0)
+    {
+        fprintf(2, "top: cpustat failed\n");
+        exit(1);
+    }
+}
+
+// percent of part in whole, to a tenth.
+static void
+percent(uint64 part, uint64 whole)
+{
+    uint64 t = whole ? part * 1000 / whole : 0;
+
+    printf("%l.%l%%", t / 10, t % 10);
+}
+
+static void
+show(struct sample *old, struct sample *new, int interval)
+{
+    uint64 wall = new->time - old->time;
+    int i, j, k;
+
+    // CPU time each process used in the interval: both samples are
+    // in pid order, so a merge finds each process's old record.
+    for (i = 0, j = 0; i < new->nproc; i++)
+    {
+        struct procsnap *r = &new->proc[i];
+        while (j < old->nproc && old->proc[j].pid < r->pid)
+            j++;
+        used[i] = r->utime + r->stime;
+        if (j < old->nproc && old->proc[j].pid == r->pid)
+            used[i] -= old->proc[j].utime + old->proc[j].stime;
+        // insertion sort, most used first.
+        for (k = i; k > 0 && used[order[k - 1]] < used[i]; k--)
+            order[k] = order[k - 1];
+        order[k] = i;
+    }
+
+    printf("\033[H\033[J");   // clear the screen
+    printf("top: %d processes, %d waiting for a CPU, every %d ticks\n",
+           new->nproc, new->ncpu > 0 ? new->cpu[0].runq : 0, interval);
+    for (i = 0; i < new->ncpu && i < old->ncpu; i++)
+    {
+        struct cpustat *c = &new->cpu[i], *o = &old->cpu[i];
+        uint64 span = c->time - o->time, idle = c->idle - o->idle;
+        if (idle > span)
+            idle = span;
+        printf("cpu%d: ", c->cpu);
+        percent(span - idle, span);
+        printf(" busy, ");
+        percent(idle, span);
+        printf(" idle, %l switches\n", c->nswitch - o->nswitch);
+    }
+    printf("\npid\tname\tstate\tprio\tcpu\t%%cpu\tms\n");
+    for (k = 0; k < new->nproc && k < NSHOW; k++)
+    {
+        struct procsnap *r = &new->proc[order[k]];
+        printf("%d\t%s\t%s\t%d\t", r->pid, r->name, states[r->state], r->priority);
+        if (r->cpu >= 0)
+            printf("%d\t", r->cpu);
+        else
+            printf("-\t");
+        percent(used[order[k]], wall);
+        printf("\t%l\n", (r->utime + r->stime) / TICKS_PER_MS);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int interval = 10, rounds = -1;
+
+    if (argc > 1)
+        interval = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (interval < 1 || argc > 3 || rounds == 0)
+    {
+        fprintf(2, "usage: top [interval in ticks] [rounds]\n");
+        exit(1);
+    }
+
+    take(&samples[0]);
+    for (int i = 1; rounds < 0 || i <= rounds; i++)
+    {
+        sleep(interval);
+        take(&samples[i % 2]);
+        show(&samples[(i + 1) % 2], &samples[i % 2], interval);
+    }
+    exit(0);
+}
@@ -1,6 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
 #include "user/user.h"
 
 //
@@ -145,3 +147,30 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Copy the kernel statistics page, which the kernel may be
+// rewriting as we read; see kernel/kstats.h.
+void
+readkstats(struct kstats *ks)
+{
+  volatile struct kstats *k = (struct kstats*)KSTATS;
+  uint64 seq;
+
+  for(;;){
+    seq = k->seq;
+    __sync_synchronize();
+    memmove(ks, (void*)k, sizeof(*ks));
+    __sync_synchronize();
+    if((seq & 1) == 0 && k->seq == seq)
+      return;
+  }
+}
+
+// Clock ticks since boot, read from the statistics page
+// without a system call. The kernel stores ticks in one
+// write, so there is no need for readkstats().
+int
+uptime(void)
+{
+  return ((volatile struct kstats*)KSTATS)->ticks;
+}
@@ -1,23 +1,13 @@
 struct stat;
-
-struct proc_info
-{
-  char name[16];
-  char pName[16]; // parent name
-  char state[9]; // running, runnable, sleeping
-  int pid;
-};
-
-struct cpu_info
-{
-  char name[16]; // name of process running on cpu
-  int cpu_num;
-};
-
-struct proc_cpu_num
-{
-  int num;
-};
+struct iovec;
+struct meminfo;
+struct spawnact;
+struct rusage;
+struct procsnap;
+struct cpustat;
+struct kstats;
+struct profsample;
+struct lockstat;
 
 // system calls
 int fork(void);
@@ -40,11 +30,30 @@ int dup(int);
 int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 int pstate(void);
 int ps(void);
 int set(int pid, int priority);
-int psinfo(struct proc_info *user_buf, struct cpu_info *cpu_user_buf, struct proc_cpu_num *user_proc_cpu_num);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int memfd(int);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int futex(int*, int, int);
+int meminfo(struct meminfo*);
+int waitpid(int, int*, int);
+int spawn(const char*, char**, struct spawnact*);
+int vfork(void);
+int wait4(int, int*, int, struct rusage*);
+int getrusage(int, struct rusage*);
+int procsnap(struct procsnap*, int, int);
+int cpustat(struct cpustat*, int);
+int profctl(int);
+int profread(struct profsample*, int);
+int lockstat(struct lockstat*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -62,3 +71,5 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void readkstats(struct kstats*);
+int uptime(void);
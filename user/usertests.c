@@ -2,8 +2,21 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
+#include "user/thread.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/mman.h"
+#include "kernel/futex.h"
+#include "kernel/meminfo.h"
+#include "kernel/wait.h"
+#include "kernel/spawn.h"
+#include "kernel/rusage.h"
+#include "kernel/procsnap.h"
+#include "kernel/cpustat.h"
+#include "kernel/kstats.h"
+#include "kernel/prof.h"
+#include "kernel/lockstat.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -420,6 +433,56 @@ truncate3(char *s)
 }
   
 
+// small files keep their data in the inode; check that they
+// read back correctly before and after growing out of it,
+// and after being truncated back to inline.
+void
+inlinefile(char *s)
+{
+  char buf[100];
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+
+  unlink("inlinefile");
+  fd = open("inlinefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i += 10){
+    if(write(fd, buf + i, 10) != 10){
+      printf("%s: write failed at %d\n", s, i);
+      exit(1);
+    }
+    close(fd);
+    fd = open("inlinefile", O_RDWR);
+    char rbuf[sizeof(buf)+1];
+    n = read(fd, rbuf, sizeof(rbuf));
+    if(n != i + 10 || memcmp(rbuf, buf, n) != 0){
+      printf("%s: read %d bytes, wanted %d\n", s, n, i + 10);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("inlinefile", O_RDWR|O_TRUNC);
+  if(write(fd, "xyz", 3) != 3){
+    printf("%s: write after truncate failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inlinefile", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  if(n != 3 || memcmp(buf, "xyz", 3) != 0){
+    printf("%s: read %d bytes after truncate, wanted 3\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  unlink("inlinefile");
+}
+
 // does chdir() call iput(p->cwd) in a transaction?
 void
 iputtest(char *s)
@@ -442,189 +505,1465 @@ iputtest(char *s)
   }
 }
 
-// does exit() call iput(p->cwd) in a transaction?
+// does exit() call iput(p->cwd) in a transaction?
+void
+exitiputtest(char *s)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(mkdir("iputdir") < 0){
+      printf("%s: mkdir failed\n", s);
+      exit(1);
+    }
+    if(chdir("iputdir") < 0){
+      printf("%s: child chdir failed\n", s);
+      exit(1);
+    }
+    if(unlink("../iputdir") < 0){
+      printf("%s: unlink ../iputdir failed\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+// does the error path in open() for attempt to write a
+// directory call iput() in a transaction?
+// needs a hacked kernel that pauses just after the namei()
+// call in sys_open():
+//    if((ip = namei(path)) == 0)
+//      return -1;
+//    {
+//      int i;
+//      for(i = 0; i < 10000; i++)
+//        yield();
+//    }
+void
+openiputtest(char *s)
+{
+  int pid, xstatus;
+
+  if(mkdir("oidir") < 0){
+    printf("%s: mkdir oidir failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    int fd = open("oidir", O_RDWR);
+    if(fd >= 0){
+      printf("%s: open directory for write succeeded\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  sleep(1);
+  if(unlink("oidir") != 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  exit(xstatus);
+}
+
+// simple file system tests
+
+void
+opentest(char *s)
+{
+  int fd;
+
+  fd = open("echo", 0);
+  if(fd < 0){
+    printf("%s: open echo failed!\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("doesnotexist", 0);
+  if(fd >= 0){
+    printf("%s: open doesnotexist succeeded!\n", s);
+    exit(1);
+  }
+}
+
+void
+writetest(char *s)
+{
+  int fd;
+  int i;
+  enum { N=100, SZ=10 };
+  
+  fd = open("small", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat small failed!\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(write(fd, "aaaaaaaaaa", SZ) != SZ){
+      printf("%s: error: write aa %d new file failed\n", s, i);
+      exit(1);
+    }
+    if(write(fd, "bbbbbbbbbb", SZ) != SZ){
+      printf("%s: error: write bb %d new file failed\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  fd = open("small", O_RDONLY);
+  if(fd < 0){
+    printf("%s: error: open small failed!\n", s);
+    exit(1);
+  }
+  i = read(fd, buf, N*SZ*2);
+  if(i != N*SZ*2){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(unlink("small") < 0){
+    printf("%s: unlink small failed\n", s);
+    exit(1);
+  }
+}
+
+void
+writebig(char *s)
+{
+  int i, fd, n;
+
+  fd = open("big", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat big failed!\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < MAXFILE; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: error: write big file failed\n", s, i);
+      exit(1);
+    }
+  }
+
+  close(fd);
+
+  fd = open("big", O_RDONLY);
+  if(fd < 0){
+    printf("%s: error: open big failed!\n", s);
+    exit(1);
+  }
+
+  n = 0;
+  for(;;){
+    i = read(fd, buf, BSIZE);
+    if(i == 0){
+      if(n == MAXFILE - 1){
+        printf("%s: read only %d blocks from big", s, n);
+        exit(1);
+      }
+      break;
+    } else if(i != BSIZE){
+      printf("%s: read failed %d\n", s, i);
+      exit(1);
+    }
+    if(((int*)buf)[0] != n){
+      printf("%s: read content of block %d is %d\n", s,
+             n, ((int*)buf)[0]);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  if(unlink("big") < 0){
+    printf("%s: unlink big failed\n", s);
+    exit(1);
+  }
+}
+
+// the blocks of large unlinked files are freed in the
+// background; repeatedly creating and unlinking files whose
+// total size exceeds the disk checks that they come back,
+// and that a write that finds the disk full waits for them.
+void
+unlinkbig(char *s)
+{
+  int i, j, fd;
+  enum { N=5, NBLOCK=400 };
+
+  for(i = 0; i < N; i++){
+    fd = open("unlinkbig", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < NBLOCK; j++){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: write %d of file %d failed\n", s, j, i);
+        exit(1);
+      }
+    }
+    close(fd);
+    if(unlink("unlinkbig") < 0){
+      printf("%s: unlink failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// writev() and readv() with buffers split differently, large
+// enough that writev() needs more than one transaction.
+void
+readvwritev(char *s)
+{
+  static char big[3*BSIZE+100];
+  char hdr[10], tail[7], got[30];
+  struct iovec iov[3];
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(big); i++)
+    big[i] = i % 101;
+  memset(hdr, 'h', sizeof(hdr));
+  memset(tail, 't', sizeof(tail));
+
+  unlink("vecfile");
+  fd = open("vecfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = big;
+  iov[1].iov_len = sizeof(big);
+  iov[2].iov_base = tail;
+  iov[2].iov_len = sizeof(tail);
+  n = writev(fd, iov, 3);
+  if(n != sizeof(hdr) + sizeof(big) + sizeof(tail)){
+    printf("%s: writev returned %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("vecfile", O_RDONLY);
+  iov[0].iov_base = got;
+  iov[0].iov_len = 15;
+  iov[1].iov_base = big;
+  iov[1].iov_len = sizeof(big) - 5;
+  iov[2].iov_base = got + 15;
+  iov[2].iov_len = 15;
+  n = readv(fd, iov, 3);
+  if(n != sizeof(hdr) + sizeof(big) + sizeof(tail)){
+    printf("%s: readv returned %d\n", s, n);
+    exit(1);
+  }
+  if(memcmp(got, "hhhhhhhhhh", 10) != 0 || memcmp(got + 15, "ttttttt", 7) != 0){
+    printf("%s: readv got wrong header or trailer\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5; i++){
+    if(got[10+i] != i){
+      printf("%s: readv got wrong data at %d\n", s, i + 10);
+      exit(1);
+    }
+  }
+  for(i = 0; i < sizeof(big) - 5; i++){
+    if(big[i] != (i + 5) % 101){
+      printf("%s: readv got wrong data at %d\n", s, i + 10);
+      exit(1);
+    }
+  }
+  if(readv(fd, iov, IOV_MAX + 1) != -1){
+    printf("%s: readv accepted too many iovecs\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vecfile");
+}
+
+// pread() and pwrite() use their own offset, not the file's.
+void
+preadpwrite(char *s)
+{
+  char buf[8];
+  int fd, fds[2];
+
+  unlink("pfile");
+  fd = open("pfile", O_CREATE|O_RDWR);
+  if(write(fd, "0123456789", 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "ab", 2, 3) != 2 || pwrite(fd, "xyz", 3, 10) != 3){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "q", 1, 20) != -1){
+    printf("%s: pwrite past end of file succeeded\n", s);
+    exit(1);
+  }
+  // the offset is still 10, where "xyz" went.
+  if(read(fd, buf, sizeof(buf)) != 3 || memcmp(buf, "xyz", 3) != 0){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 6, 1) != 6 || memcmp(buf, "12ab56", 6) != 0){
+    printf("%s: pread got wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 13) != 0){
+    printf("%s: pread at end of file returned data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pfile");
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "a", 1, 0) != -1 || pread(fds[0], buf, 1, 0) != -1){
+    printf("%s: positional I/O on a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// map a file shared and private, and check which stores
+// reach the file.
+void
+mmaptest(char *s)
+{
+  char *p, *q, b[3];
+  int fd, i;
+
+  unlink("mfile");
+  fd = open("mfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 2*PGSIZE + 100; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, 2*PGSIZE + 100) != 2*PGSIZE + 100){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, 2*PGSIZE + 100, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, 2*PGSIZE + 100, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2*PGSIZE + 100; i++){
+    if(p[i] != 'a' + i % 26 || q[i] != p[i]){
+      printf("%s: wrong mapped byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  // the rest of the last page reads as zeros.
+  if(p[2*PGSIZE + 100] != 0 || p[3*PGSIZE - 1] != 0){
+    printf("%s: junk after end of file\n", s);
+    exit(1);
+  }
+
+  p[1] = 'S';
+  q[2] = 'P';
+  if(q[1] != 'S'){
+    printf("%s: private mapping missed a shared store\n", s);
+    exit(1);
+  }
+  if(p[2] != 'c'){
+    printf("%s: private store reached the shared mapping\n", s);
+    exit(1);
+  }
+  // write() is visible through mappings of pages not stored to.
+  if(pwrite(fd, "W", 1, PGSIZE) != 1 || p[PGSIZE] != 'W' || q[PGSIZE] != 'W'){
+    printf("%s: write not seen through mapping\n", s);
+    exit(1);
+  }
+  // and write() from a mapping works.
+  if(pwrite(fd, p + 1, 1, 2*PGSIZE) != 1){
+    printf("%s: write from mapping failed\n", s);
+    exit(1);
+  }
+  // read() sees a shared store before it is written back,
+  // even across a page boundary, but not a private one.
+  p[PGSIZE - 1] = 'E';
+  if(pread(fd, b, 3, 0) != 3 || memcmp(b, "aSc", 3) != 0 ||
+     pread(fd, b, 2, PGSIZE - 1) != 2 || memcmp(b, "EW", 2) != 0){
+    printf("%s: read missed a shared store\n", s);
+    exit(1);
+  }
+
+  // unmap the first page, then the rest.
+  if(munmap(p, PGSIZE) != 0 || munmap(q, 3*PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 3, 0) != 3 || memcmp(b, "aSc", 3) != 0){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  if(p[PGSIZE] != 'W' || munmap(p + PGSIZE, 2*PGSIZE) != 0){
+    printf("%s: lost the rest of the region\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 1, 2*PGSIZE) != 1 || b[0] != 'S'){
+    printf("%s: write from mapping wrote wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mfile", O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf("%s: writable shared mapping of read-only fd\n", s);
+    exit(1);
+  }
+  if((p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED){
+    printf("%s: private mapping of read-only fd failed\n", s);
+    exit(1);
+  }
+  // the mapping outlives the fd.
+  close(fd);
+  p[0] = 'x';
+  if(p[1] != 'S'){
+    printf("%s: mapping lost after close\n", s);
+    exit(1);
+  }
+  unlink("mfile");
+}
+
+// a child inherits its parent's mappings; shared stores are
+// seen by both, private ones by neither.
+void
+mmapfork(char *s)
+{
+  char *p, *q;
+  int fd, pid, xstatus;
+
+  unlink("mfile");
+  fd = open("mfile", O_CREATE|O_RDWR);
+  if(write(fd, "hello", 5) != 5){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, 5, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, 5, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  q[0] = 'j';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[0] != 'h' || q[0] != 'j')
+      exit(1);
+    p[1] = 'a';
+    q[1] = 'o';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong data\n", s);
+    exit(1);
+  }
+  if(p[1] != 'a' || q[1] != 'e'){
+    printf("%s: wrong data after child's stores\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mfile");
+}
+
+// processes share a memfd's pages through fork and mmap().
+void
+memfdtest(char *s)
+{
+  enum { N = 4, SZ = 2*PGSIZE };
+  int fd, i, j, pid, xstatus;
+  char *p;
+
+  if(memfd(0) != -1){
+    printf("%s: memfd(0) succeeded\n", s);
+    exit(1);
+  }
+  fd = memfd(N*SZ);
+  if(fd < 0){
+    printf("%s: memfd failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "hdr", 3) != 3){
+    printf("%s: write to memfd failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, N*SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || memcmp(p, "hdr", 3) != 0){
+    printf("%s: mmap of memfd failed\n", s);
+    exit(1);
+  }
+  // each child fills its own part; the parent sees it all.
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 4; j < SZ; j++)
+        p[i*SZ + j] = i + j;
+      exit(0);
+    }
+  }
+  for(i = 0; i < N; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  for(i = 0; i < N; i++){
+    for(j = 4; j < SZ; j++){
+      if(p[i*SZ + j] != (char)(i + j)){
+        printf("%s: wrong shared byte %d of part %d\n", s, j, i);
+        exit(1);
+      }
+    }
+  }
+  // the object outlives the mapping while the fd is open,
+  // and read() sees the same bytes.
+  if(munmap(p, N*SZ) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, SZ, PROT_READ, MAP_SHARED, fd, SZ);
+  if(p == MAP_FAILED || p[4] != (char)5){
+    printf("%s: memfd lost its data\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, 2) != 2 || buf[0] != 0 || buf[1] != 4){
+    printf("%s: read from memfd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(p[SZ - 1] != (char)(1 + SZ - 1)){
+    printf("%s: mapping lost after close\n", s);
+    exit(1);
+  }
+}
+
+static struct mutex tmu;
+static int tcount, tfd;
+static char *tmem;
+
+static void
+tcounter(void *arg)
+{
+  for(int i = 0; i < 1000; i++){
+    mutex_lock(&tmu);
+    tcount++;
+    mutex_unlock(&tmu);
+  }
+  if(arg == 0){
+    // the other threads see this thread's files and memory.
+    tfd = open("threadf", O_CREATE|O_RDWR);
+    tmem = sbrk(PGSIZE);
+    tmem[0] = 'x';
+  }
+}
+
+static void
+tsleeper(void *arg)
+{
+  sleep(5);
+  *(int*)arg = 1;
+}
+
+// clone()d threads share memory, sbrk() and open files; join()
+// reaps them and wait() does not, and a thread's exit() ends
+// only that thread.
+void
+threadtest(char *s)
+{
+  enum { N = 4 };
+  int tids[N], i, pid, xstatus, x;
+
+  mutex_init(&tmu);
+  tcount = 0;
+  tfd = -1;
+  tmem = 0;
+  for(i = 0; i < N; i++){
+    if((tids[i] = thread_create(tcounter, (void*)(uint64)i)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() reaped a thread\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(thread_join(tids[i]) != 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(join(tids[0], 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+  if(tcount != N*1000){
+    printf("%s: count %d, not %d\n", s, tcount, N*1000);
+    exit(1);
+  }
+  if(tfd < 0 || write(tfd, "a", 1) != 1){
+    printf("%s: thread's file not shared\n", s);
+    exit(1);
+  }
+  close(tfd);
+  unlink("threadf");
+  if(tmem == 0 || tmem[0] != 'x'){
+    printf("%s: thread's memory not shared\n", s);
+    exit(1);
+  }
+
+  x = 0;
+  if(futex(&x, FUTEX_WAIT, 1) != -1 || futex(&x, FUTEX_WAKE, 1) != 0){
+    printf("%s: futex on a changed value\n", s);
+    exit(1);
+  }
+
+  // the main thread's exit() ends the process, sleeping
+  // threads and all.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(thread_create(tsleeper, &x) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child with a thread failed\n", s);
+    exit(1);
+  }
+}
+
+static void
+tspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+static void
+tfutexwait(void *arg)
+{
+  for(;;)
+    futex((int*)arg, FUTEX_WAIT, 0);
+}
+
+// whether process pid exists, if only as a zombie.
+static int
+pidexists(int pid)
+{
+  struct procsnap r;
+
+  return procsnap(&r, pid - 1, 1) == 1 && r.pid == pid;
+}
+
+// kill() takes every thread of a process with it, as does the
+// exit() of its main thread; the threads are gone once wait()
+// sees the process exit, and init reaps them.
+void
+killthreads(char *s)
+{
+  enum { N = 3 };
+  static int fx;
+  int fds[2], tids[N], pid, xstatus, i, t, viakill;
+
+  for(viakill = 1; viakill >= 0; viakill--){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      for(i = 0; i < N; i++){
+        // one sleeps, the others run.
+        if((tids[i] = thread_create(i == 0 ? tfutexwait : tspin, &fx)) < 0)
+          exit(1);
+      }
+      write(fds[1], tids, sizeof(tids));
+      if(!viakill)
+        exit(0);
+      for(;;)
+        sleep(1);
+    }
+    close(fds[1]);
+    if(read(fds[0], tids, sizeof(tids)) != sizeof(tids)){
+      printf("%s: child made no threads\n", s);
+      exit(1);
+    }
+    close(fds[0]);
+    if(viakill)
+      kill(pid);
+    if(wait(&xstatus) != pid || xstatus != (viakill ? -1 : 0)){
+      printf("%s: wait for the child failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      for(t = 0; pidexists(tids[i]); t++){
+        if(t > 100){
+          printf("%s: thread %d outlived its process\n", s, tids[i]);
+          exit(1);
+        }
+        sleep(1);
+      }
+    }
+  }
+}
+
+static struct mutex cmu;
+static struct cond ccv;
+static int cqueue, cdone;
+static struct barrier cbar;
+static int cphase[4];
+
+static void
+tconsumer(void *arg)
+{
+  int *got = arg;
+
+  mutex_lock(&cmu);
+  for(;;){
+    while(cqueue == 0 && !cdone)
+      cond_wait(&ccv, &cmu);
+    if(cqueue == 0)
+      break;
+    cqueue--;
+    (*got)++;
+  }
+  mutex_unlock(&cmu);
+}
+
+static void
+tphase(void *arg)
+{
+  int id = (int)(uint64)arg;
+
+  for(int r = 0; r < 20; r++){
+    cphase[id] = r;
+    barrier_wait(&cbar);
+    for(int j = 0; j < 4; j++){
+      if(cphase[j] < r){
+        printf("barrier: thread %d passed round %d early\n", j, r);
+        exit(1);
+      }
+    }
+  }
+}
+
+// condition variables and barriers.
+void
+condbarrier(char *s)
+{
+  enum { N = 4, ITEMS = 500 };
+  int tids[N], got[N], i, sum;
+
+  mutex_init(&cmu);
+  cond_init(&ccv);
+  cqueue = cdone = 0;
+  for(i = 0; i < N; i++){
+    got[i] = 0;
+    if((tids[i] = thread_create(tconsumer, &got[i])) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < ITEMS; i++){
+    mutex_lock(&cmu);
+    cqueue++;
+    cond_signal(&ccv);
+    mutex_unlock(&cmu);
+  }
+  mutex_lock(&cmu);
+  cdone = 1;
+  cond_broadcast(&ccv);
+  mutex_unlock(&cmu);
+  sum = 0;
+  for(i = 0; i < N; i++){
+    thread_join(tids[i]);
+    sum += got[i];
+  }
+  if(sum != ITEMS){
+    printf("%s: consumed %d of %d\n", s, sum, ITEMS);
+    exit(1);
+  }
+
+  barrier_init(&cbar, N);
+  for(i = 0; i < N; i++){
+    if((tids[i] = thread_create(tphase, (void*)(uint64)i)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++)
+    thread_join(tids[i]);
+}
+
+// heap memory in megapages: grown at once, grown a little at a
+// time, copied by fork(), and shrunk into the middle of one.
+void
+megapages(char *s)
+{
+  enum { MEGA = 2*1024*1024, N = 3*MEGA };
+  char *a, *p;
+  uint64 top;
+  int pid, xstatus;
+
+  top = (uint64)sbrk(0);
+  if(sbrk((MEGA - top % MEGA) % MEGA) == (char*)-1){
+    printf("%s: sbrk to align failed\n", s);
+    exit(1);
+  }
+  a = sbrk(N);
+  if(a == (char*)-1){
+    printf("%s: sbrk(%d) failed\n", s, N);
+    exit(1);
+  }
+  for(p = a; p < a + N; p += PGSIZE){
+    if(*p != 0){
+      printf("%s: new heap not zero\n", s);
+      exit(1);
+    }
+    *(uint64*)p = (uint64)p;
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + N; p += PGSIZE){
+      if(*(uint64*)p != (uint64)p)
+        exit(1);
+      *(uint64*)p = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw the wrong heap\n", s);
+    exit(1);
+  }
+
+  // shrink to the middle of the second megapage.
+  if(sbrk(-(MEGA + MEGA/2 + PGSIZE)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + MEGA + MEGA/2 - PGSIZE; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: fork or shrink changed the parent's heap\n", s);
+      exit(1);
+    }
+  }
+
+  // grow it back a little at a time; the kernel may gather
+  // the pages into a megapage.
+  while((uint64)sbrk(0) < (uint64)a + N){
+    p = sbrk(16*PGSIZE + 100);
+    if(p == (char*)-1){
+      printf("%s: sbrk regrow failed\n", s);
+      exit(1);
+    }
+    *(p + 16*PGSIZE) = 1;
+  }
+  for(p = a; p < a + MEGA + MEGA/2 - PGSIZE; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: regrow changed the heap\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(sbrk(0) - a));
+}
+
+// meminfo() adds up, and shows the pages that sbrk() takes.
+void
+meminfotest(char *s)
+{
+  struct meminfo m0, m1;
+  uint64 n;
+  int k;
+
+  if(meminfo(&m0) < 0){
+    printf("%s: meminfo failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  for(k = 0; k <= MAXORDER; k++)
+    n += m0.nblocks[k] << k;
+  if(n != m0.nfree || m0.nfree > m0.npages){
+    printf("%s: free blocks add up to %d pages, not %d\n", s, (int)n, (int)m0.nfree);
+    exit(1);
+  }
+  if(sbrk(64*PGSIZE) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(meminfo(&m1) < 0 || m1.nfree + 64 > m0.nfree){
+    printf("%s: sbrk took no memory\n", s);
+    exit(1);
+  }
+  if(meminfo((struct meminfo*)0xffffffffffffL) != -1){
+    printf("%s: meminfo to a bad address succeeded\n", s);
+    exit(1);
+  }
+}
+
+// more files open at once, across processes, than a fixed
+// table of a hundred would hold: each child fills its
+// descriptors with pipes and waits for the others.
+void
+manyfiles(char *s)
+{
+  enum { NCHILD = 16 };
+  int ready[2], hold[2], fds[2];
+  int i, n, xstatus;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(hold) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(hold[1]);
+      for(n = 0; pipe(fds) == 0; n += 2)
+        ;
+      write(ready[1], "x", 1);
+      read(hold[0], &c, 1);
+      if(n < NOFILE - 6){
+        printf("%s: only %d pipe fds\n", s, n);
+        exit(1);
+      }
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(hold[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1)
+      break;
+  }
+  close(hold[1]);
+  close(ready[0]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// more processes at once than a fixed table of 64 would
+// hold. each child waits on a pipe; kill() finds half of
+// them by pid, and the rest see the pipe close.
+void
+manyprocs(char *s)
+{
+  enum { N = 200 };
+  int fds[2], pids[N];
+  int i, n;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < N; n++){
+    pids[n] = fork();
+    if(pids[n] < 0)
+      break;
+    if(pids[n] == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  for(i = 0; i < n; i += 2){
+    if(kill(pids[i]) < 0){
+      printf("%s: kill %d failed\n", s, pids[i]);
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < n; i++){
+    if(wait(0) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+  if(n < N){
+    printf("%s: only %d forks\n", s, n);
+    exit(1);
+  }
+  if(kill(pids[0]) != -1){
+    printf("%s: kill of a reaped pid succeeded\n", s);
+    exit(1);
+  }
+}
+
+// waitpid() waits for the child it names, and with WNOHANG
+// does not wait at all.
+void
+waitpidtest(char *s)
+{
+  int fds[2], fast, slow, xstatus;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  slow = fork();
+  if(slow < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(slow == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(4);
+  }
+  close(fds[0]);
+  fast = fork();
+  if(fast < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(fast == 0)
+    exit(3);
+
+  if(waitpid(slow, &xstatus, WNOHANG) != 0){
+    printf("%s: WNOHANG waited for a running child\n", s);
+    exit(1);
+  }
+  if(waitpid(fast, &xstatus, 0) != fast || xstatus != 3){
+    printf("%s: waitpid for the exited child failed\n", s);
+    exit(1);
+  }
+  if(waitpid(fast, 0, 0) != -1){
+    printf("%s: waitpid found a reaped child\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(waitpid(-1, &xstatus, 0) != slow || xstatus != 4){
+    printf("%s: waitpid for any child failed\n", s);
+    exit(1);
+  }
+  if(waitpid(-1, 0, WNOHANG) != -1){
+    printf("%s: WNOHANG without children did not fail\n", s);
+    exit(1);
+  }
+}
+
+// a child's CPU time is charged to it, and wait4() and
+// getrusage() report it, and no more than it used.
+void
+rusagetest(char *s)
+{
+  struct rusage ru, cru;
+  struct kstats a, b;
+  int pid, xstatus;
+  uint64 t0;
+
+  readkstats(&a);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // spin in user space for a few ticks of the clock, then sleep.
+    // uptime() reads the statistics page, so make some system
+    // calls too.
+    t0 = uptime();
+    while(uptime() < t0 + 3)
+      getpid();
+    sleep(1);
+    exit(7);
+  }
+  if(wait4(pid, &xstatus, 0, &ru) != pid || xstatus != 7){
+    printf("%s: wait4 failed\n", s);
+    exit(1);
+  }
+  readkstats(&b);
+  if(ru.utime == 0 || ru.stime == 0 || ru.nvcsw == 0 ||
+     ru.nsyscall < 3 || ru.cycles == 0 || ru.instret == 0){
+    printf("%s: child's usage not charged\n", s);
+    exit(1);
+  }
+  // the child lived a little over 4 ticks; the statistics
+  // page's clock is a tick behind, so allow a second more.
+  if(ru.utime + ru.stime + ru.wtime > b.time - a.time + b.timefreq ||
+     ru.nsyscall > ru.instret || ru.instret > ru.cycles * 8){
+    printf("%s: child's usage is implausible\n", s);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_CHILDREN, &cru) < 0 || cru.utime != ru.utime ||
+     cru.stime != ru.stime || cru.nvcsw != ru.nvcsw ||
+     cru.nsyscall != ru.nsyscall || cru.cycles != ru.cycles){
+    printf("%s: getrusage of children does not match wait4\n", s);
+    exit(1);
+  }
+  if(getrusage(RUSAGE_SELF, &ru) < 0 || ru.stime == 0){
+    printf("%s: getrusage of self failed\n", s);
+    exit(1);
+  }
+  if(getrusage(3, &ru) != -1){
+    printf("%s: getrusage accepted a bad who\n", s);
+    exit(1);
+  }
+}
+
+// procsnap() pages through every process once, in pid order,
+// with consistent records.
+void
+procsnaptest(char *s)
+{
+  enum { N = 5 };
+  struct procsnap buf[2];
+  int fds[2], pids[N], seen[N], i, j, n, cursor, self = 0;
+  char c;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+    seen[i] = 0;
+  }
+  close(fds[0]);
+  sleep(1);
+
+  // two records at a time, so the cursor has to work.
+  cursor = 0;
+  while((n = procsnap(buf, cursor, 2)) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i].version != PROCSNAP_VERSION || buf[i].pid <= cursor){
+        printf("%s: bad record for pid %d\n", s, buf[i].pid);
+        exit(1);
+      }
+      cursor = buf[i].pid;
+      if(buf[i].pid == getpid()){
+        self++;
+        if(buf[i].state != PS_RUNNING || buf[i].cpu < 0 || buf[i].memsz == 0){
+          printf("%s: wrong record for self\n", s);
+          exit(1);
+        }
+      }
+      for(j = 0; j < N; j++){
+        if(buf[i].pid == pids[j]){
+          seen[j]++;
+          if(buf[i].ppid != getpid() || buf[i].state != PS_SLEEPING ||
+             buf[i].chan == 0 || buf[i].cpu != -1){
+            printf("%s: wrong record for child %d\n", s, pids[j]);
+            exit(1);
+          }
+        }
+      }
+    }
+  }
+  if(n < 0){
+    printf("%s: procsnap failed\n", s);
+    exit(1);
+  }
+  if(self != 1){
+    printf("%s: saw self %d times\n", s, self);
+    exit(1);
+  }
+  for(j = 0; j < N; j++){
+    if(seen[j] != 1){
+      printf("%s: saw child %d %d times\n", s, pids[j], seen[j]);
+      exit(1);
+    }
+  }
+
+  close(fds[1]);
+  for(i = 0; i < N; i++)
+    wait(0);
+}
+
+// cpustat() reports each started CPU, and its counts only grow.
 void
-exitiputtest(char *s)
+cpustattest(char *s)
 {
-  int pid, xstatus;
+  struct cpustat a[NCPU], b[NCPU];
+  int i, n;
 
-  pid = fork();
-  if(pid < 0){
-    printf("%s: fork failed\n", s);
+  if((n = cpustat(a, NCPU)) < 1 || n > NCPU){
+    printf("%s: cpustat returned %d\n", s, n);
     exit(1);
   }
-  if(pid == 0){
-    if(mkdir("iputdir") < 0){
-      printf("%s: mkdir failed\n", s);
-      exit(1);
-    }
-    if(chdir("iputdir") < 0){
-      printf("%s: child chdir failed\n", s);
-      exit(1);
-    }
-    if(unlink("../iputdir") < 0){
-      printf("%s: unlink ../iputdir failed\n", s);
+  sleep(2);
+  if(cpustat(b, NCPU) != n){
+    printf("%s: number of CPUs changed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(b[i].cpu != a[i].cpu || b[i].time <= a[i].time ||
+       b[i].idle < a[i].idle || b[i].nswitch < a[i].nswitch ||
+       b[i].idle - a[i].idle > b[i].time - a[i].time + 10000){
+      printf("%s: bad counts for cpu %d\n", s, b[i].cpu);
       exit(1);
     }
-    exit(0);
   }
-  wait(&xstatus);
-  exit(xstatus);
+  if(cpustat(a, 0) != 0){
+    printf("%s: cpustat of no CPUs failed\n", s);
+    exit(1);
+  }
 }
 
-// does the error path in open() for attempt to write a
-// directory call iput() in a transaction?
-// needs a hacked kernel that pauses just after the namei()
-// call in sys_open():
-//    if((ip = namei(path)) == 0)
-//      return -1;
-//    {
-//      int i;
-//      for(i = 0; i < 10000; i++)
-//        yield();
-//    }
+// the kernel statistics page is readable, moves with the
+// clock, and cannot be written.
 void
-openiputtest(char *s)
+kstatstest(char *s)
 {
+  struct kstats a, b;
   int pid, xstatus;
 
-  if(mkdir("oidir") < 0){
-    printf("%s: mkdir oidir failed\n", s);
+  readkstats(&a);
+  if((a.seq & 1) || a.timefreq == 0 || a.ncpu < 1 || a.ncpu > NCPU ||
+     a.nproc < 1 || a.freepages == 0 || a.time < a.boottime){
+    printf("%s: bad statistics page\n", s);
+    exit(1);
+  }
+  sleep(2);
+  if(uptime() < a.ticks + 2){
+    printf("%s: uptime() did not move\n", s);
+    exit(1);
+  }
+  readkstats(&b);
+  if(b.seq <= a.seq || b.ticks < a.ticks + 2 || b.time <= a.time ||
+     b.cpu[0].nsyscall < a.cpu[0].nsyscall){
+    printf("%s: statistics did not move\n", s);
     exit(1);
   }
+
   pid = fork();
   if(pid < 0){
     printf("%s: fork failed\n", s);
     exit(1);
   }
   if(pid == 0){
-    int fd = open("oidir", O_RDWR);
-    if(fd >= 0){
-      printf("%s: open directory for write succeeded\n", s);
-      exit(1);
-    }
+    ((volatile struct kstats*)KSTATS)->ticks = 0;
     exit(0);
   }
-  sleep(1);
-  if(unlink("oidir") != 0){
-    printf("%s: unlink failed\n", s);
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote the statistics page\n", s);
     exit(1);
   }
-  wait(&xstatus);
-  exit(xstatus);
 }
 
-// simple file system tests
+static struct profsample profbuf[64];
 
+// sample while spinning in user space: some samples must be of
+// this process, in its code, and the clock must not speed up
+// with the timer.
 void
-opentest(char *s)
+proftest(char *s)
 {
-  int fd;
+  uint64 t0, tm;
+  int i, n, got = 0, mine = 0, up[2], down[2], pid, xstatus;
+  char c;
 
-  fd = open("echo", 0);
-  if(fd < 0){
-    printf("%s: open echo failed!\n", s);
+  if(profctl(1) < 0){
+    printf("%s: profctl failed\n", s);
     exit(1);
   }
-  close(fd);
-  fd = open("doesnotexist", 0);
-  if(fd >= 0){
-    printf("%s: open doesnotexist succeeded!\n", s);
+  t0 = uptime();
+  asm volatile("rdtime %0" : "=r"(tm));
+  while(uptime() < t0 + 3){
+    while((n = profread(profbuf, 64)) > 0){
+      for(i = 0; i < n; i++){
+        if(profbuf[i].npc < 1 || profbuf[i].npc > NPROFPC ||
+           profbuf[i].nkernel > profbuf[i].npc ||
+           profbuf[i].cpu < 0 || profbuf[i].cpu >= NCPU){
+          printf("%s: bad sample\n", s);
+          profctl(0);
+          exit(1);
+        }
+        if(profbuf[i].pid == getpid() && profbuf[i].nkernel < profbuf[i].npc &&
+           profbuf[i].pc[profbuf[i].nkernel] < (uint64)sbrk(0))
+          mine++;
+      }
+      got += n;
+    }
+  }
+  asm volatile("rdtime %0" : "=r"(t0));
+  profctl(0);
+  if(t0 - tm < 2 * TICKCYCLES){
+    printf("%s: clock ran fast\n", s);
+    exit(1);
+  }
+  if(got == 0 || mine == 0){
+    printf("%s: %d samples, %d of this process\n", s, got, mine);
+    exit(1);
+  }
+  while(profread(profbuf, 64) > 0)
+    ;
+  if(profread(profbuf, 64) != 0){
+    printf("%s: samples after profiling stopped\n", s);
     exit(1);
   }
-}
 
-void
-writetest(char *s)
-{
-  int fd;
-  int i;
-  enum { N=100, SZ=10 };
-  
-  fd = open("small", O_CREATE|O_RDWR);
-  if(fd < 0){
-    printf("%s: error: creat small failed!\n", s);
+  // profiling belongs to the process that turned it on: no
+  // other can take it over, and it stops when that one exits.
+  if(pipe(up) < 0 || pipe(down) < 0){
+    printf("%s: pipe failed\n", s);
     exit(1);
   }
-  for(i = 0; i < N; i++){
-    if(write(fd, "aaaaaaaaaa", SZ) != SZ){
-      printf("%s: error: write aa %d new file failed\n", s, i);
-      exit(1);
-    }
-    if(write(fd, "bbbbbbbbbb", SZ) != SZ){
-      printf("%s: error: write bb %d new file failed\n", s, i);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(profctl(1) < 0)
       exit(1);
-    }
+    write(up[1], "x", 1);
+    read(down[0], &c, 1);
+    exit(0);
   }
-  close(fd);
-  fd = open("small", O_RDONLY);
-  if(fd < 0){
-    printf("%s: error: open small failed!\n", s);
+  if(read(up[0], &c, 1) != 1){
+    printf("%s: child could not turn profiling on\n", s);
     exit(1);
   }
-  i = read(fd, buf, N*SZ*2);
-  if(i != N*SZ*2){
-    printf("%s: read failed\n", s);
+  if(profctl(1) != -1){
+    printf("%s: took over another process's profiling\n", s);
+    kill(pid);
     exit(1);
   }
-  close(fd);
+  write(down[1], "x", 1);
+  wait(&xstatus);
+  if(profctl(1) < 0){
+    printf("%s: profiling still on after its owner exited\n", s);
+    exit(1);
+  }
+  profctl(0);
+  close(up[0]);
+  close(up[1]);
+  close(down[0]);
+  close(down[1]);
+}
 
-  if(unlink("small") < 0){
-    printf("%s: unlink small failed\n", s);
+static struct lockstat lockbuf[64];
+
+// the counts of the lock class named name, of spinlocks or of
+// sleep-locks, or 0.
+static struct lockstat*
+lockclassof(char *s, char *name, int sleep, int flags)
+{
+  int i, n;
+
+  if((n = lockstat(lockbuf, 64, flags)) < 1){
+    printf("%s: lockstat returned %d\n", s, n);
     exit(1);
   }
+  for(i = 0; i < n; i++)
+    if(strcmp(lockbuf[i].name, name) == 0 && lockbuf[i].sleep == sleep)
+      return &lockbuf[i];
+  return 0;
 }
 
+// fork() takes proc locks and writing a file takes inode
+// sleep-locks, so both classes count; a reset zeroes them.
 void
-writebig(char *s)
+lockstattest(char *s)
 {
-  int i, fd, n;
+  struct lockstat *l;
+  uint64 nproc, ninode;
+  int fd, pid;
 
-  fd = open("big", O_CREATE|O_RDWR);
-  if(fd < 0){
-    printf("%s: error: creat big failed!\n", s);
+  if((l = lockclassof(s, "proc", 0, 0)) == 0 || l->nacquire == 0 ||
+     l->ncontend > l->nacquire){
+    printf("%s: no proc lock counts\n", s);
     exit(1);
   }
-
-  for(i = 0; i < MAXFILE; i++){
-    ((int*)buf)[0] = i;
-    if(write(fd, buf, BSIZE) != BSIZE){
-      printf("%s: error: write big file failed\n", s, i);
-      exit(1);
-    }
+  nproc = l->nacquire;
+  if((l = lockclassof(s, "inode", 1, 0)) == 0 || l->nacquire == 0){
+    printf("%s: no inode sleep-lock counts\n", s);
+    exit(1);
   }
+  ninode = l->nacquire;
 
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+  if((fd = open("lockstat", O_CREATE|O_RDWR)) < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
   close(fd);
+  unlink("lockstat");
 
-  fd = open("big", O_RDONLY);
-  if(fd < 0){
-    printf("%s: error: open big failed!\n", s);
+  l = lockclassof(s, "proc", 0, 0);
+  if(l->nacquire <= nproc){
+    printf("%s: proc lock acquisitions not counted\n", s);
     exit(1);
   }
-
-  n = 0;
-  for(;;){
-    i = read(fd, buf, BSIZE);
-    if(i == 0){
-      if(n == MAXFILE - 1){
-        printf("%s: read only %d blocks from big", s, n);
-        exit(1);
-      }
-      break;
-    } else if(i != BSIZE){
-      printf("%s: read failed %d\n", s, i);
-      exit(1);
-    }
-    if(((int*)buf)[0] != n){
-      printf("%s: read content of block %d is %d\n", s,
-             n, ((int*)buf)[0]);
-      exit(1);
-    }
-    n++;
+  l = lockclassof(s, "inode", 1, LOCKSTAT_RESET);
+  if(l->nacquire <= ninode){
+    printf("%s: inode sleep-lock acquisitions not counted\n", s);
+    exit(1);
   }
-  close(fd);
-  if(unlink("big") < 0){
-    printf("%s: unlink big failed\n", s);
+  ninode = l->nacquire;
+  l = lockclassof(s, "inode", 1, 0);
+  if(l->nacquire >= ninode){
+    printf("%s: reset did not zero the counts\n", s);
     exit(1);
   }
 }
@@ -730,6 +2069,140 @@ exectest(char *s)
 
 }
 
+// spawn() starts a program without copying the caller,
+// after applying its file actions to the child's files.
+void
+spawntest(char *s)
+{
+  int fd, fds[2], xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  struct spawnact act[4];
+  char buf[3];
+
+  unlink("spawn-ok");
+  act[0].op = SPAWN_OPEN;
+  act[0].fd = 1;
+  act[0].mode = O_CREATE|O_WRONLY;
+  act[0].path = "spawn-ok";
+  act[1].op = 0;
+  if((pid = spawn("echo", echoargv, act)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  fd = open("spawn-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output in file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP2;
+  act[0].fd = fds[1];
+  act[0].newfd = 1;
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = fds[1];
+  act[3].op = 0;
+  if((pid = spawn("echo", echoargv, act)) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 3) != 3 || buf[0] != 'O' || buf[1] != 'K' ||
+     read(fds[0], buf, 1) != 0){
+    printf("%s: wrong output in pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  // failures leave no child behind.
+  if(spawn("nosuchprogram", echoargv, 0) >= 0){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_CLOSE;
+  act[0].fd = NOFILE;
+  act[1].op = 0;
+  if(spawn("echo", echoargv, act) >= 0){
+    printf("%s: spawn with a bad action succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn made a child\n", s);
+    exit(1);
+  }
+}
+
+// a vfork()ed child shares the parent's memory, which waits
+// until the child execs or exits, but has its own open files.
+static volatile int vforked;
+
+void
+vforktest(char *s)
+{
+  static char *echoargv[] = { "echo", "OK", 0 };
+  int fd, xstatus, pid;
+  char buf[3];
+
+  vforked = 0;
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    vforked = 1;
+    exit(5);
+  }
+  if(vforked != 1){
+    printf("%s: parent went on before the child exited\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 5){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  unlink("vfork-ok");
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open("vfork-ok", O_CREATE|O_WRONLY) != 1)
+      exit(1);
+    exec("echo", echoargv);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  fd = open("vfork-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vfork-ok");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1921,9 +3394,10 @@ dirfile(char *s)
 void
 iref(char *s)
 {
+  enum { N = 51 };
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -1945,7 +3419,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -1953,13 +3427,11 @@ iref(char *s)
   chdir("/");
 }
 
-// test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// test that fork fails gracefully, when memory runs out.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = 100000 };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1976,7 +3448,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2444,6 +3916,46 @@ textwrite(char *s)
     exit(xstatus);
 }
 
+// exec() pages the program in as it runs: the kernel must fault
+// text in for write(), and a child's stores to initialized data
+// must not show through to its parent.
+int lazydata[3000] = { 1, 2, 3 };
+void
+lazyimage(char *s)
+{
+  char *text = (char*)PGSIZE;
+  int fd, pid, xstatus;
+
+  unlink("lazyimage");
+  fd = open("lazyimage", O_CREATE|O_RDWR);
+  if(write(fd, text, 4*PGSIZE) != 4*PGSIZE){
+    printf("%s: write from text failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4*PGSIZE, 0) != 4*PGSIZE || memcmp(buf, text, 4*PGSIZE) != 0){
+    printf("%s: text read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("lazyimage");
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    lazydata[0] = 100;
+    lazydata[2999] = 100;
+    exit(lazydata[1] == 2 && lazydata[2998] == 0 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || lazydata[0] != 1 || lazydata[2999] != 0){
+    printf("%s: initialized data wrong\n", s);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2584,15 +4096,38 @@ struct test {
   {truncate1, "truncate1"},
   {truncate2, "truncate2"},
   {truncate3, "truncate3"},
+  {inlinefile, "inlinefile"},
   {openiputtest, "openiput"},
   {exitiputtest, "exitiput"},
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {unlinkbig, "unlinkbig"},
+  {readvwritev, "readvwritev"},
+  {preadpwrite, "preadpwrite"},
+  {mmaptest, "mmaptest"},
+  {mmapfork, "mmapfork"},
+  {memfdtest, "memfdtest"},
+  {threadtest, "threadtest"},
+  {killthreads, "killthreads"},
+  {condbarrier, "condbarrier"},
+  {megapages, "megapages"},
+  {meminfotest, "meminfotest"},
+  {manyfiles, "manyfiles"},
+  {manyprocs, "manyprocs"},
+  {waitpidtest, "waitpidtest"},
+  {rusagetest, "rusagetest"},
+  {procsnaptest, "procsnaptest"},
+  {cpustattest, "cpustattest"},
+  {kstatstest, "kstatstest"},
+  {proftest, "proftest"},
+  {lockstattest, "lockstattest"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {spawntest, "spawntest"},
+  {vforktest, "vforktest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -2630,6 +4165,7 @@ struct test {
   {argptest, "argptest"},
   {stacktest, "stacktest"},
   {textwrite, "textwrite"},
+  {lazyimage, "lazyimage"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
   {sbrklast, "sbrklast"},
@@ -2837,7 +4373,6 @@ diskfull(char *s)
       break;
     }
     for(int i = 0; i < MAXFILE; i++){
-      char buf[BSIZE];
       if(write(fd, buf, BSIZE) != BSIZE){
         done = 1;
         close(fd);
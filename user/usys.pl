@@ -35,8 +35,27 @@ entry("dup");
 entry("getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
 entry("pstate");
 entry("ps");
 entry("set");
-entry("psinfo");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("mmap");
+entry("munmap");
+entry("memfd");
+entry("clone");
+entry("join");
+entry("futex");
+entry("meminfo");
+entry("waitpid");
+entry("spawn");
+entry("vfork");
+entry("wait4");
+entry("getrusage");
+entry("procsnap");
+entry("cpustat");
+entry("profctl");
+entry("profread");
+entry("lockstat");